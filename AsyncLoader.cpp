@@ -0,0 +1,192 @@
+#include "AsyncLoader.hpp"
+
+#include "gl_errors.hpp"
+
+#include <algorithm>
+#include <chrono>
+
+//file has been read by the worker?
+template< typename T >
+static bool is_ready(std::future< T > const &future) {
+	return future.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+}
+
+struct MeshBufferJob : AsyncLoader::Job {
+	std::shared_ptr< Async< MeshBuffer > > handle;
+	std::future< MeshBuffer::Data > reading;
+
+	MeshBuffer::Data data;
+	bool have_data = false;
+
+	//the vertex, element, and position-only buffers, each filled over as many updates as the budget requires:
+	struct Upload {
+		GLenum target = GL_ARRAY_BUFFER;
+		std::vector< uint8_t > const *bytes = nullptr;
+		GLuint buffer = 0;
+		size_t uploaded = 0; //bytes already in 'buffer'
+	};
+	Upload uploads[3]; //vertices, indices, positions
+	enum : uint32_t { Vertices = 0, Indices = 1, Positions = 2 };
+
+	//(jobs are destroyed by update() or cancel(), on the OpenGL thread with the context current)
+	virtual ~MeshBufferJob() {
+		for (auto &u : uploads) {
+			if (u.buffer != 0) glDeleteBuffers(1, &u.buffer);
+		}
+	}
+
+	virtual bool step(size_t *budget) override {
+		//if nobody else holds the handle, the result would be thrown away -- stop without uploading (more of) it:
+		// (a read still in progress has to be waited out, since destroying the future would block)
+		bool abandoned = (handle.use_count() == 1);
+
+		if (!have_data) {
+			if (!is_ready(reading)) return false;
+			try {
+				data = reading.get();
+			} catch (...) {
+				handle->error = std::current_exception();
+				return true;
+			}
+			if (abandoned) return true;
+			have_data = true;
+
+			//allocate storage now:
+			// (element buffers can be filled without a vertex array object bound by going through another target)
+			uploads[Vertices].bytes = &data.vertices;
+			uploads[Indices].target = GL_COPY_WRITE_BUFFER;
+			uploads[Indices].bytes = &data.indices;
+			uploads[Positions].bytes = &data.positions;
+			for (auto &u : uploads) {
+				if (u.bytes->empty()) continue;
+				glGenBuffers(1, &u.buffer);
+				glBindBuffer(u.target, u.buffer);
+				glBufferData(u.target, u.bytes->size(), nullptr, GL_STATIC_DRAW);
+				glBindBuffer(u.target, 0);
+			}
+		} else if (abandoned) {
+			return true;
+		}
+
+		for (auto &u : uploads) {
+			size_t amount = std::min(*budget, u.bytes->size() - u.uploaded);
+			if (amount > 0) {
+				glBindBuffer(u.target, u.buffer);
+				glBufferSubData(u.target, u.uploaded, amount, u.bytes->data() + u.uploaded);
+				glBindBuffer(u.target, 0);
+				u.uploaded += amount;
+				*budget -= amount;
+			}
+			if (u.uploaded < u.bytes->size()) return false;
+		}
+
+		handle->value = std::make_shared< MeshBuffer >(data, uploads[Vertices].buffer, uploads[Indices].buffer, uploads[Positions].buffer);
+		for (auto &u : uploads) {
+			u.buffer = 0;
+		}
+		return true;
+	}
+};
+
+struct SceneJob : AsyncLoader::Job {
+	std::shared_ptr< Async< Scene > > handle;
+	std::function< void(Scene &, Scene::Transform *, std::string const &) > on_drawable;
+
+	//mesh entries found by the worker, passed to on_drawable once the scene is read:
+	// (declared before 'reading' so the worker is finished before this is destroyed)
+	std::vector< std::pair< Scene::Transform *, std::string > > drawables;
+	std::future< std::shared_ptr< Scene > > reading;
+
+	std::shared_ptr< Scene > scene; //read scene, waiting for the rest of its on_drawable calls
+	size_t called = 0; //entries of 'drawables' already passed to on_drawable
+
+	//budget charged per on_drawable call (the calls don't upload much themselves, but a scene may have very many):
+	static constexpr size_t DrawableCost = 1 << 10;
+
+	virtual bool step(size_t *budget) override {
+		if (!scene) {
+			if (!is_ready(reading)) return false;
+			try {
+				scene = reading.get();
+			} catch (...) {
+				handle->error = std::current_exception();
+				return true;
+			}
+		}
+		//nobody is waiting for the scene any more:
+		if (handle.use_count() == 1) return true;
+
+		try {
+			if (on_drawable) {
+				//(always makes some progress, even with an exhausted budget)
+				do {
+					if (called == drawables.size()) break;
+					auto const &d = drawables[called];
+					++called;
+					on_drawable(*scene, d.first, d.second);
+					*budget -= std::min(*budget, DrawableCost);
+				} while (*budget > 0);
+				if (called < drawables.size()) return false;
+			}
+			handle->value = scene;
+		} catch (...) {
+			handle->error = std::current_exception();
+		}
+		return true;
+	}
+};
+
+AsyncLoader::~AsyncLoader() {
+	//(destroying jobs waits for any worker threads still reading)
+	jobs.clear();
+}
+
+AsyncLoader &AsyncLoader::shared() {
+	static AsyncLoader loader;
+	return loader;
+}
+
+std::shared_ptr< Async< MeshBuffer > > AsyncLoader::load_mesh_buffer(std::string const &filename, bool position_stream) {
+	auto job = std::make_unique< MeshBufferJob >();
+	job->handle = std::make_shared< Async< MeshBuffer > >();
+	job->reading = std::async(std::launch::async, [filename, position_stream](){
+		return MeshBuffer::read(filename, position_stream);
+	});
+	auto handle = job->handle;
+	jobs.emplace_back(std::move(job));
+	return handle;
+}
+
+std::shared_ptr< Async< Scene > > AsyncLoader::load_scene(std::string const &filename, std::function< void(Scene &, Scene::Transform *, std::string const &) > const &on_drawable) {
+	auto job = std::make_unique< SceneJob >();
+	job->handle = std::make_shared< Async< Scene > >();
+	job->on_drawable = on_drawable;
+	auto *drawables = &job->drawables;
+	job->reading = std::async(std::launch::async, [filename, drawables](){
+		auto scene = std::make_shared< Scene >();
+		//(on_drawable may need OpenGL, so just remember what to call it with)
+		scene->load(filename, [drawables](Scene &, Scene::Transform *transform, std::string const &mesh_name){
+			drawables->emplace_back(transform, mesh_name);
+		});
+		return scene;
+	});
+	auto handle = job->handle;
+	jobs.emplace_back(std::move(job));
+	return handle;
+}
+
+void AsyncLoader::cancel() {
+	//(waits for any worker threads still reading)
+	jobs.clear();
+}
+
+void AsyncLoader::update(size_t byte_budget) {
+	for (auto j = jobs.begin(); j != jobs.end(); /* later */) {
+		if ((*j)->step(&byte_budget)) {
+			j = jobs.erase(j);
+		} else {
+			++j;
+		}
+	}
+	GL_ERRORS();
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+/*
+ * AsyncLoader loads scenes and mesh buffers in the background.
+ *
+ * File reading and parsing happen on worker threads; the remaining OpenGL
+ *  work (buffer uploads, on_drawable callbacks) happens in update(), which
+ *  should be called once per frame on the OpenGL thread and does a bounded
+ *  amount of uploading each call:
+ *
+ *  //start loading:
+ *  auto level = AsyncLoader::shared().load_scene(data_path("level.scene"), ...);
+ *  auto level_meshes = AsyncLoader::shared().load_mesh_buffer(data_path("level.pnct"));
+ *
+ *  //in the main loop:
+ *  AsyncLoader::shared().update();
+ *
+ *  //later:
+ *  if (level->ready()) scene = level->get();
+ *
+ */
+
+#include "Mesh.hpp"
+#include "Scene.hpp"
+
+#include <exception>
+#include <functional>
+#include <future>
+#include <list>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+//Handle to something being loaded:
+template< typename T >
+struct Async {
+	//has loading finished (successfully or not)?
+	bool ready() const { return value || error; }
+	//the loaded value; re-throws any exception thrown while loading (and throws if not ready yet):
+	T const &get() const {
+		if (error) std::rethrow_exception(error);
+		if (!value) throw std::runtime_error("Async value requested before it finished loading.");
+		return *value;
+	}
+
+	std::shared_ptr< T > value;
+	std::exception_ptr error;
+};
+
+struct AsyncLoader {
+	~AsyncLoader();
+
+	//start reading a mesh buffer; its vertex data is uploaded by later calls to update():
+	// ('position_stream' as in the MeshBuffer constructor)
+	std::shared_ptr< Async< MeshBuffer > > load_mesh_buffer(std::string const &filename, bool position_stream = false);
+
+	//start reading a scene; 'on_drawable' is called (during update(), on the OpenGL thread) once the file is read:
+	std::shared_ptr< Async< Scene > > load_scene(std::string const &filename,
+		std::function< void(Scene &, Scene::Transform *, std::string const &) > const &on_drawable = nullptr
+	);
+
+	//do pending OpenGL work for loads whose files have been read, uploading at most about 'byte_budget' bytes:
+	// (call once per frame, on the OpenGL thread)
+	void update(size_t byte_budget = 4 << 20);
+
+	//number of loads that haven't finished yet:
+	size_t pending() const { return jobs.size(); }
+
+	//abandon all unfinished loads (their handles never become ready), freeing any OpenGL buffers they made:
+	// (call on the OpenGL thread before the context goes away; loads whose handles are dropped are also abandoned, during update())
+	void cancel();
+
+	//process-wide loader:
+	static AsyncLoader &shared();
+
+	//-- internals ---
+	struct Job {
+		virtual ~Job() { }
+		//advance this load, spending from *budget; returns true when finished:
+		virtual bool step(size_t *budget) = 0;
+	};
+	std::list< std::unique_ptr< Job > > jobs;
+};
@@ -0,0 +1,257 @@
+#include "DrawableBVH.hpp"
+
+#include <algorithm>
+#include <cassert>
+
+//world-space bounds of a drawable:
+static void drawable_bounds(Scene::Drawable const &drawable, glm::vec3 *min, glm::vec3 *max) {
+	assert(drawable.transform);
+	transform_box(drawable.transform->local_to_world(), drawable.min, drawable.max, min, max);
+}
+
+static bool boxes_overlap(glm::vec3 const &a_min, glm::vec3 const &a_max, glm::vec3 const &b_min, glm::vec3 const &b_max) {
+	return a_min.x <= b_max.x && b_min.x <= a_max.x
+	    && a_min.y <= b_max.y && b_min.y <= a_max.y
+	    && a_min.z <= b_max.z && b_min.z <= a_max.z;
+}
+
+//slab test; returns true (and sets *t to the entry distance) if the ray hits the box within [0, max_t]:
+static bool ray_box(glm::vec3 const &origin, glm::vec3 const &inv_direction, glm::vec3 const &min, glm::vec3 const &max, float max_t, float *t) {
+	float t_min = 0.0f;
+	float t_max = max_t;
+	for (int c = 0; c < 3; ++c) {
+		float t0 = (min[c] - origin[c]) * inv_direction[c];
+		float t1 = (max[c] - origin[c]) * inv_direction[c];
+		if (t0 > t1) std::swap(t0, t1);
+		t_min = std::max(t_min, t0);
+		t_max = std::min(t_max, t1);
+		if (t_min > t_max) return false;
+	}
+	*t = t_min;
+	return true;
+}
+
+void DrawableBVH::update(Scene const &scene) {
+	//rebuild if the set of drawables (or which ones are bounded) changed since the last build:
+	bool same = (built_from.size() == scene.drawables.size());
+	if (same) {
+		auto b = built_from.begin();
+		for (auto const &drawable : scene.drawables) {
+			if (b->first != &drawable || b->second != drawable.has_bounds()) {
+				same = false;
+				break;
+			}
+			++b;
+		}
+	}
+
+	if (!same) build(scene);
+	else refit();
+}
+
+void DrawableBVH::build(Scene const &scene) {
+	nodes.clear();
+	items.clear();
+	unbounded.clear();
+	built_from.clear();
+
+	built_from.reserve(scene.drawables.size());
+	items.reserve(scene.drawables.size());
+	for (auto const &drawable : scene.drawables) {
+		built_from.emplace_back(&drawable, drawable.has_bounds());
+		if (!drawable.has_bounds()) {
+			unbounded.emplace_back(&drawable);
+			continue;
+		}
+		items.emplace_back();
+		Item &item = items.back();
+		item.drawable = &drawable;
+		item.transform = drawable.transform;
+		item.generation = drawable.transform->world_generation();
+		item.local_min = drawable.min;
+		item.local_max = drawable.max;
+		drawable_bounds(drawable, &item.min, &item.max);
+	}
+
+	if (!items.empty()) {
+		nodes.reserve(2 * (items.size() / LeafSize + 1));
+		build_node(0, uint32_t(items.size()), -1U);
+	}
+}
+
+uint32_t DrawableBVH::build_node(uint32_t begin, uint32_t end, uint32_t parent) {
+	assert(begin < end);
+	uint32_t index = uint32_t(nodes.size());
+	nodes.emplace_back();
+	nodes[index].parent = parent;
+
+	//bounds of items and of their centers:
+	glm::vec3 min = glm::vec3( std::numeric_limits< float >::infinity());
+	glm::vec3 max = glm::vec3(-std::numeric_limits< float >::infinity());
+	glm::vec3 center_min = min;
+	glm::vec3 center_max = max;
+	for (uint32_t i = begin; i < end; ++i) {
+		min = glm::min(min, items[i].min);
+		max = glm::max(max, items[i].max);
+		glm::vec3 center = 0.5f * (items[i].min + items[i].max);
+		center_min = glm::min(center_min, center);
+		center_max = glm::max(center_max, center);
+	}
+	nodes[index].min = min;
+	nodes[index].max = max;
+
+	if (end - begin <= LeafSize) {
+		nodes[index].right_or_first = begin;
+		nodes[index].count = end - begin;
+		for (uint32_t i = begin; i < end; ++i) {
+			items[i].leaf = index;
+		}
+		return index;
+	}
+
+	//split at the median along the axis where centers are most spread out:
+	glm::vec3 extent = center_max - center_min;
+	int axis = 0;
+	if (extent.y > extent[axis]) axis = 1;
+	if (extent.z > extent[axis]) axis = 2;
+	uint32_t mid = begin + (end - begin) / 2;
+	std::nth_element(items.begin() + begin, items.begin() + mid, items.begin() + end, [axis](Item const &a, Item const &b) {
+		return a.min[axis] + a.max[axis] < b.min[axis] + b.max[axis];
+	});
+
+	build_node(begin, mid, index);
+	uint32_t right = build_node(mid, end, index);
+	nodes[index].right_or_first = right;
+	nodes[index].count = 0;
+
+	return index;
+}
+
+uint32_t DrawableBVH::refit() {
+	std::vector< bool > dirty(nodes.size(), false);
+	uint32_t moved = 0;
+
+	//recompute bounds of items whose transforms or local bounds changed, marking their leaves (and ancestors) dirty:
+	for (auto &item : items) {
+		Scene::Drawable const &drawable = *item.drawable;
+		uint32_t generation = drawable.transform->world_generation();
+		if (drawable.transform == item.transform && generation == item.generation
+		 && drawable.min == item.local_min && drawable.max == item.local_max) continue;
+		item.transform = drawable.transform;
+		item.generation = generation;
+		item.local_min = drawable.min;
+		item.local_max = drawable.max;
+		drawable_bounds(drawable, &item.min, &item.max);
+		++moved;
+		for (uint32_t n = item.leaf; n != -1U && !dirty[n]; n = nodes[n].parent) {
+			dirty[n] = true;
+		}
+	}
+	if (moved == 0) return 0;
+
+	//children come after parents, so a reverse sweep updates bottom-up:
+	for (uint32_t n = uint32_t(nodes.size()); n-- > 0; ) {
+		if (!dirty[n]) continue;
+		Node &node = nodes[n];
+		if (node.count > 0) {
+			node.min = glm::vec3( std::numeric_limits< float >::infinity());
+			node.max = glm::vec3(-std::numeric_limits< float >::infinity());
+			for (uint32_t i = node.right_or_first; i < node.right_or_first + node.count; ++i) {
+				node.min = glm::min(node.min, items[i].min);
+				node.max = glm::max(node.max, items[i].max);
+			}
+		} else {
+			Node const &left = nodes[n + 1];
+			Node const &right = nodes[node.right_or_first];
+			node.min = glm::min(left.min, right.min);
+			node.max = glm::max(left.max, right.max);
+		}
+	}
+
+	return moved;
+}
+
+uint32_t DrawableBVH::query_frustum(Frustum const &frustum, std::vector< Scene::Drawable const * > *out_) const {
+	assert(out_);
+	auto &out = *out_;
+	out.insert(out.end(), unbounded.begin(), unbounded.end());
+
+	uint32_t tested = 0;
+	if (nodes.empty()) return tested;
+
+	std::vector< uint32_t > stack;
+	stack.emplace_back(0);
+	while (!stack.empty()) {
+		uint32_t n = stack.back();
+		stack.pop_back();
+		Node const &node = nodes[n];
+		if (!frustum.intersects_box(node.min, node.max)) continue;
+		if (node.count > 0) {
+			for (uint32_t i = node.right_or_first; i < node.right_or_first + node.count; ++i) {
+				++tested;
+				if (frustum.intersects_box(items[i].min, items[i].max)) out.emplace_back(items[i].drawable);
+			}
+		} else {
+			stack.emplace_back(node.right_or_first);
+			stack.emplace_back(n + 1);
+		}
+	}
+	return tested;
+}
+
+void DrawableBVH::query_box(glm::vec3 const &min, glm::vec3 const &max, std::vector< Scene::Drawable const * > *out_) const {
+	assert(out_);
+	auto &out = *out_;
+	if (nodes.empty()) return;
+
+	std::vector< uint32_t > stack;
+	stack.emplace_back(0);
+	while (!stack.empty()) {
+		uint32_t n = stack.back();
+		stack.pop_back();
+		Node const &node = nodes[n];
+		if (!boxes_overlap(node.min, node.max, min, max)) continue;
+		if (node.count > 0) {
+			for (uint32_t i = node.right_or_first; i < node.right_or_first + node.count; ++i) {
+				if (boxes_overlap(items[i].min, items[i].max, min, max)) out.emplace_back(items[i].drawable);
+			}
+		} else {
+			stack.emplace_back(node.right_or_first);
+			stack.emplace_back(n + 1);
+		}
+	}
+}
+
+Scene::Drawable const *DrawableBVH::query_ray(glm::vec3 const &origin, glm::vec3 const &direction, float *t_, float max_t) const {
+	if (nodes.empty()) return nullptr;
+
+	//(division by zero gives +/-infinity here, which the slab test handles)
+	glm::vec3 inv_direction = glm::vec3(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+
+	Scene::Drawable const *best = nullptr;
+	float best_t = max_t;
+
+	std::vector< uint32_t > stack;
+	stack.emplace_back(0);
+	while (!stack.empty()) {
+		uint32_t n = stack.back();
+		stack.pop_back();
+		Node const &node = nodes[n];
+		float t;
+		if (!ray_box(origin, inv_direction, node.min, node.max, best_t, &t)) continue;
+		if (node.count > 0) {
+			for (uint32_t i = node.right_or_first; i < node.right_or_first + node.count; ++i) {
+				if (ray_box(origin, inv_direction, items[i].min, items[i].max, best_t, &t) && (!best || t < best_t)) {
+					best_t = t;
+					best = items[i].drawable;
+				}
+			}
+		} else {
+			stack.emplace_back(node.right_or_first);
+			stack.emplace_back(n + 1);
+		}
+	}
+
+	if (best && t_) *t_ = best_t;
+	return best;
+}
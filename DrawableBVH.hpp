@@ -0,0 +1,83 @@
+#pragma once
+
+/*
+ * DrawableBVH is a bounding volume hierarchy over the world-space bounding
+ *  boxes of a scene's drawables.
+ *
+ * It serves both culling in Scene::draw (set Scene::bvh to enable) and
+ *  gameplay queries like "which drawable did the mouse click".
+ *
+ * update() rebuilds the tree when the set of drawables (or which of them have
+ *  bounds) changes and otherwise refits it: only leaves whose transforms moved
+ *  (detected via Transform::world_generation()), whose local bounds changed,
+ *  or whose drawable now points at a different transform are recomputed,
+ *  along with their ancestors.
+ *
+ * Drawables are compared by address and contents, so a drawable re-created
+ *  in a recycled list node is handled like an edit of the old one.
+ *
+ */
+
+#include "Scene.hpp"
+#include "Frustum.hpp"
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cstdint>
+
+struct DrawableBVH {
+	//bring the tree up to date with 'scene' (rebuild or refit as needed):
+	void update(Scene const &scene);
+
+	//always rebuild the tree from scratch:
+	void build(Scene const &scene);
+
+	//recompute bounds of moved (or re-bounded) drawables and their ancestors; returns number of drawables that changed:
+	uint32_t refit();
+
+	//append drawables whose world bounds intersect the frustum to 'out':
+	// (drawables without bounds are always appended)
+	// returns the number of drawable bounds tested
+	uint32_t query_frustum(Frustum const &frustum, std::vector< Scene::Drawable const * > *out) const;
+
+	//append drawables whose world bounds overlap the box [min,max] to 'out':
+	void query_box(glm::vec3 const &min, glm::vec3 const &max, std::vector< Scene::Drawable const * > *out) const;
+
+	//find the nearest drawable whose world bounds are hit by the ray origin + t * direction, t in [0, max_t]:
+	// returns nullptr if nothing is hit; otherwise sets *t (if given) to the entry distance
+	Scene::Drawable const *query_ray(glm::vec3 const &origin, glm::vec3 const &direction, float *t = nullptr, float max_t = std::numeric_limits< float >::infinity()) const;
+
+	//-- internals ---
+
+	struct Node {
+		glm::vec3 min = glm::vec3( std::numeric_limits< float >::infinity());
+		glm::vec3 max = glm::vec3(-std::numeric_limits< float >::infinity());
+		uint32_t parent = -1U;
+		//interior nodes (count == 0) have left child at (this index + 1) and right child at 'right_or_first';
+		//leaves (count > 0) hold items [right_or_first, right_or_first + count):
+		uint32_t right_or_first = 0;
+		uint32_t count = 0;
+	};
+	std::vector< Node > nodes; //nodes[0] is the root; children always come after parents
+
+	struct Item {
+		Scene::Drawable const *drawable = nullptr;
+		//what the world bounds were computed from:
+		Scene::Transform const *transform = nullptr;
+		uint32_t generation = 0; //transform world generation
+		glm::vec3 local_min, local_max; //drawable's local bounds
+		uint32_t leaf = 0; //index of leaf node holding this item
+		glm::vec3 min, max; //world-space bounds
+	};
+	std::vector< Item > items;
+
+	//drawables with no bounds; they can't be culled:
+	std::vector< Scene::Drawable const * > unbounded;
+
+	//drawables in scene order at the time of the last build, and whether each had bounds (used to detect changes):
+	std::vector< std::pair< Scene::Drawable const *, bool > > built_from;
+
+	enum : uint32_t { LeafSize = 4 };
+	uint32_t build_node(uint32_t begin, uint32_t end, uint32_t parent);
+};
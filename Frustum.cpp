@@ -0,0 +1,46 @@
+#include "Frustum.hpp"
+
+#include <cassert>
+
+Frustum::Frustum(glm::mat4 const &world_to_clip) {
+	//rows of the matrix (glm is column-major, so gather them by hand):
+	glm::vec4 row[4];
+	for (int r = 0; r < 4; ++r) {
+		row[r] = glm::vec4(world_to_clip[0][r], world_to_clip[1][r], world_to_clip[2][r], world_to_clip[3][r]);
+	}
+	//-w <= x,y,z <= w in clip space:
+	planes[0] = row[3] + row[0];
+	planes[1] = row[3] - row[0];
+	planes[2] = row[3] + row[1];
+	planes[3] = row[3] - row[1];
+	planes[4] = row[3] + row[2];
+	planes[5] = row[3] - row[2];
+}
+
+bool Frustum::intersects_box(glm::vec3 const &min, glm::vec3 const &max) const {
+	for (auto const &plane : planes) {
+		//test the box corner furthest along the plane normal ("p-vertex"):
+		glm::vec3 p = glm::vec3(
+			(plane.x >= 0.0f ? max.x : min.x),
+			(plane.y >= 0.0f ? max.y : min.y),
+			(plane.z >= 0.0f ? max.z : min.z)
+		);
+		if (plane.x * p.x + plane.y * p.y + plane.z * p.z + plane.w < 0.0f) return false;
+	}
+	return true;
+}
+
+void transform_box(glm::mat4x3 const &local_to_world, glm::vec3 const &min, glm::vec3 const &max, glm::vec3 *world_min, glm::vec3 *world_max) {
+	assert(world_min);
+	assert(world_max);
+	//transform center and extents (Arvo's method):
+	glm::vec3 center = 0.5f * (min + max);
+	glm::vec3 radius = 0.5f * (max - min);
+	glm::vec3 world_center = local_to_world * glm::vec4(center, 1.0f);
+	glm::vec3 world_radius = glm::vec3(0.0f);
+	for (int c = 0; c < 3; ++c) {
+		world_radius += glm::abs(local_to_world[c]) * radius[c];
+	}
+	*world_min = world_center - world_radius;
+	*world_max = world_center + world_radius;
+}
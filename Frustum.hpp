@@ -0,0 +1,26 @@
+#pragma once
+
+/*
+ * Frustum holds the six clip planes of a world_to_clip matrix and provides
+ *  conservative visibility tests for bounding boxes.
+ *
+ * A point p is inside plane i if dot(planes[i], vec4(p, 1)) >= 0.
+ *
+ */
+
+#include <glm/glm.hpp>
+
+struct Frustum {
+	Frustum() = default;
+	//extract planes from a world-to-clip matrix (Gribb & Hartmann):
+	// (works fine with infinite perspective; the far plane just becomes trivially true)
+	explicit Frustum(glm::mat4 const &world_to_clip);
+
+	glm::vec4 planes[6]; //left, right, bottom, top, near, far
+
+	//conservative: returns false only if the box is entirely outside some plane:
+	bool intersects_box(glm::vec3 const &min, glm::vec3 const &max) const;
+};
+
+//compute the world-space axis-aligned box containing a local-space box transformed by 'local_to_world':
+void transform_box(glm::mat4x3 const &local_to_world, glm::vec3 const &min, glm::vec3 const &max, glm::vec3 *world_min, glm::vec3 *world_max);
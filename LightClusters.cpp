@@ -0,0 +1,271 @@
+#include "LightClusters.hpp"
+
+#include "WorkerPool.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CLUSTERS_SSE2 1
+#include <emmintrin.h>
+#else
+#define CLUSTERS_SSE2 0
+#endif
+
+LightClusters::LightClusters(uint32_t tiles_x_, uint32_t tiles_y_, uint32_t slices_)
+	: tiles_x(std::max(tiles_x_, 1U)), tiles_y(std::max(tiles_y_, 1U)), slices(std::max(slices_, 1U)) {
+	stride_x = (tiles_x + 3U) & ~3U;
+	stride_y = (tiles_y + 3U) & ~3U;
+}
+
+uint32_t LightClusters::slice_of(float depth) const {
+	if (!(depth > near)) return 0;
+	float s = std::log(depth / near) / std::log(far / near) * float(slices);
+	if (!(s < float(slices))) return slices - 1;
+	return uint32_t(s);
+}
+
+void LightClusters::setup(glm::mat4x3 const &world_to_view, float fovy, float aspect, std::vector< Light > const &lights) {
+	//slice depths, exponentially spaced:
+	slice_depth.resize(slices + 1);
+	for (uint32_t z = 0; z <= slices; ++z) {
+		slice_depth[z] = near * std::pow(far / near, float(z) / float(slices));
+	}
+	slice_depth[0] = near;
+	slice_depth[slices] = far;
+
+	//view-space x (and y) range of each column (row) of clusters, per slice:
+	// (tile edges are planes through the eye, so the range is spanned by the edges at the slice's two depths)
+	float tan_y = std::tan(0.5f * fovy);
+	float tan_x = tan_y * aspect;
+	auto ranges = [&](uint32_t tiles, uint32_t stride, float tan, std::vector< float > *lo, std::vector< float > *hi) {
+		//padding entries are empty ranges, which are never touched:
+		lo->assign(slices * stride, std::numeric_limits< float >::infinity());
+		hi->assign(slices * stride,-std::numeric_limits< float >::infinity());
+		for (uint32_t z = 0; z < slices; ++z) {
+			float d0 = slice_depth[z];
+			float d1 = slice_depth[z+1];
+			for (uint32_t i = 0; i < tiles; ++i) {
+				float s0 = (-1.0f + 2.0f * float(i) / float(tiles)) * tan;
+				float s1 = (-1.0f + 2.0f * float(i + 1) / float(tiles)) * tan;
+				(*lo)[z * stride + i] = std::min(s0 * d0, s0 * d1);
+				(*hi)[z * stride + i] = std::max(s1 * d0, s1 * d1);
+			}
+		}
+	};
+	ranges(tiles_x, stride_x, tan_x, &x_lo, &x_hi);
+	ranges(tiles_y, stride_y, tan_y, &y_lo, &y_hi);
+
+	//lights to view space:
+	glm::mat3 rotation = glm::mat3(world_to_view);
+	view_lights.clear();
+	view_lights.reserve(lights.size());
+	for (auto const &light : lights) {
+		view_lights.emplace_back();
+		ViewLight &vl = view_lights.back();
+		vl.position = world_to_view * glm::vec4(light.position, 1.0f);
+		vl.radius = std::max(0.0f, light.radius);
+		vl.direction = glm::normalize(rotation * light.direction);
+		vl.cos_half_angle = light.cos_half_angle;
+		vl.sin_half_angle = std::sqrt(std::max(0.0f, 1.0f - light.cos_half_angle * light.cos_half_angle));
+	}
+
+	stats = Stats();
+}
+
+bool LightClusters::touches(ViewLight const &light, uint32_t x, uint32_t y, uint32_t z) const {
+	//squared distance from the light's position to the cluster's bounds:
+	glm::vec3 const &p = light.position;
+	float dx = std::max(std::max(x_lo[z * stride_x + x] - p.x, 0.0f), p.x - x_hi[z * stride_x + x]);
+	float dy = std::max(std::max(y_lo[z * stride_y + y] - p.y, 0.0f), p.y - y_hi[z * stride_y + y]);
+	float dz = std::max(std::max(-slice_depth[z+1] - p.z, 0.0f), p.z + slice_depth[z]);
+	//(assign() computes the same sum in the same order)
+	float dist2 = (dx * dx + dy * dy) + dz * dz;
+	if (dist2 > light.radius * light.radius) return false;
+	return cone_touches(light, x, y, z);
+}
+
+bool LightClusters::cone_touches(ViewLight const &light, uint32_t x, uint32_t y, uint32_t z) const {
+	//point lights (and spots wider than a hemisphere) are covered by the sphere test:
+	if (light.cos_half_angle <= 0.0f) return true;
+
+	//test the cone against the cluster's bounding sphere:
+	glm::vec3 lo = glm::vec3(x_lo[z * stride_x + x], y_lo[z * stride_y + y], -slice_depth[z+1]);
+	glm::vec3 hi = glm::vec3(x_hi[z * stride_x + x], y_hi[z * stride_y + y], -slice_depth[z]);
+	glm::vec3 center = 0.5f * (lo + hi);
+	float radius = 0.5f * glm::length(hi - lo);
+
+	glm::vec3 to_center = center - light.position;
+	float along = glm::dot(to_center, light.direction);
+	float across = std::sqrt(std::max(0.0f, glm::dot(to_center, to_center) - along * along));
+	//distance from the sphere's center to the cone's surface:
+	float outside = light.cos_half_angle * across - light.sin_half_angle * along;
+	if (outside > radius) return false;
+	if (along > radius + light.radius) return false; //beyond the cone's range
+	if (along < -radius) return false; //behind the light
+	return true;
+}
+
+void LightClusters::assign(glm::mat4x3 const &world_to_view, float fovy, float aspect, std::vector< Light > const &lights, WorkerPool *pool) {
+	setup(world_to_view, fovy, aspect, lights);
+
+	//bin lights by the slices their depth range touches (widened by a slice to absorb rounding; the exact tests sort it out):
+	slice_work.resize(slices);
+	for (auto &work : slice_work) {
+		work.lights.clear();
+	}
+	for (uint32_t l = 0; l < uint32_t(view_lights.size()); ++l) {
+		ViewLight const &light = view_lights[l];
+		float depth = -light.position.z;
+		if (depth + light.radius >= near && depth - light.radius <= far) stats.lights_in_range += 1;
+		uint32_t z0 = slice_of(depth - light.radius);
+		uint32_t z1 = slice_of(depth + light.radius);
+		z0 = (z0 > 0 ? z0 - 1 : 0);
+		z1 = std::min(z1 + 1, slices - 1);
+		for (uint32_t z = z0; z <= z1; ++z) {
+			slice_work[z].lights.emplace_back(l);
+		}
+	}
+
+	auto do_slice = [&](uint32_t z) {
+		SliceWork &work = slice_work[z];
+		work.pairs.clear();
+		work.tested = 0;
+		work.dx2.resize(stride_x);
+		work.dy2.resize(stride_y);
+		float const *xl = x_lo.data() + z * stride_x;
+		float const *xh = x_hi.data() + z * stride_x;
+		float const *yl = y_lo.data() + z * stride_y;
+		float const *yh = y_hi.data() + z * stride_y;
+		float z_lo = -slice_depth[z+1];
+		float z_hi = -slice_depth[z];
+
+		for (uint32_t l : work.lights) {
+			ViewLight const &light = view_lights[l];
+			glm::vec3 const &p = light.position;
+			float r2 = light.radius * light.radius;
+
+			//(since the terms of dist2 are non-negative, a single term over r2 rules a cluster out exactly as touches() would)
+			float dz = std::max(std::max(z_lo - p.z, 0.0f), p.z - z_hi);
+			float dz2 = dz * dz;
+			if (dz2 > r2) continue;
+
+			//squared distance along x (y) to every column (row):
+			auto axis = [&](float const *lo, float const *hi, float c, uint32_t stride, float *d2) {
+				uint32_t i = 0;
+				#if CLUSTERS_SSE2
+				if (simd) {
+					__m128 const zero = _mm_setzero_ps();
+					__m128 const center = _mm_set1_ps(c);
+					for (; i < stride; i += 4) {
+						__m128 d = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(lo + i), center), zero), _mm_sub_ps(center, _mm_loadu_ps(hi + i)));
+						_mm_storeu_ps(d2 + i, _mm_mul_ps(d, d));
+					}
+				}
+				#endif
+				for (; i < stride; ++i) {
+					float d = std::max(std::max(lo[i] - c, 0.0f), c - hi[i]);
+					d2[i] = d * d;
+				}
+			};
+			axis(xl, xh, p.x, stride_x, work.dx2.data());
+			axis(yl, yh, p.y, stride_y, work.dy2.data());
+
+			//columns in reach are contiguous (the ranges are sorted), so find the first and last:
+			uint32_t x0 = 0;
+			while (x0 < tiles_x && work.dx2[x0] > r2) ++x0;
+			if (x0 == tiles_x) continue;
+			uint32_t x1 = tiles_x - 1;
+			while (work.dx2[x1] > r2) --x1;
+
+			for (uint32_t y = 0; y < tiles_y; ++y) {
+				if (work.dy2[y] > r2) continue;
+				float dyz2 = work.dy2[y];
+				uint32_t row = tiles_x * y;
+				work.tested += x1 - x0 + 1;
+
+				uint32_t x = x0;
+				#if CLUSTERS_SSE2
+				if (simd) {
+					__m128 const dy2 = _mm_set1_ps(dyz2);
+					__m128 const dz2_4 = _mm_set1_ps(dz2);
+					__m128 const r2_4 = _mm_set1_ps(r2);
+					for (; x + 3 <= x1; x += 4) {
+						__m128 dist2 = _mm_add_ps(_mm_add_ps(_mm_loadu_ps(work.dx2.data() + x), dy2), dz2_4);
+						int mask = _mm_movemask_ps(_mm_cmple_ps(dist2, r2_4));
+						for (uint32_t b = 0; b < 4; ++b) {
+							if ((mask & (1 << b)) && cone_touches(light, x + b, y, z)) {
+								work.pairs.emplace_back(row + x + b, l);
+							}
+						}
+					}
+				}
+				#endif
+				for (; x <= x1; ++x) {
+					float dist2 = (work.dx2[x] + dyz2) + dz2;
+					if (dist2 <= r2 && cone_touches(light, x, y, z)) {
+						work.pairs.emplace_back(row + x, l);
+					}
+				}
+			}
+		}
+	};
+
+	if (!pool) pool = &WorkerPool::shared();
+	pool->parallel_for(slices, [&](uint32_t begin, uint32_t end) {
+		for (uint32_t z = begin; z < end; ++z) do_slice(z);
+	}, 1);
+
+	//compact into per-cluster lists (a stable counting sort, so lights stay in increasing order):
+	uint32_t per_slice = tiles_x * tiles_y;
+	clusters.assign(per_slice * slices, Cluster());
+	for (uint32_t z = 0; z < slices; ++z) {
+		for (auto const &pair : slice_work[z].pairs) {
+			clusters[z * per_slice + pair.first].count += 1;
+		}
+		stats.clusters_tested += slice_work[z].tested;
+	}
+	uint32_t total = 0;
+	for (auto &cluster : clusters) {
+		cluster.offset = total;
+		total += cluster.count;
+	}
+	indices.resize(total);
+	std::vector< uint32_t > cursor(clusters.size());
+	for (uint32_t c = 0; c < uint32_t(clusters.size()); ++c) {
+		cursor[c] = clusters[c].offset;
+	}
+	for (uint32_t z = 0; z < slices; ++z) {
+		for (auto const &pair : slice_work[z].pairs) {
+			indices[cursor[z * per_slice + pair.first]++] = pair.second;
+		}
+	}
+	stats.assignments = total;
+}
+
+void LightClusters::assign_brute_force(glm::mat4x3 const &world_to_view, float fovy, float aspect, std::vector< Light > const &lights) {
+	setup(world_to_view, fovy, aspect, lights);
+
+	clusters.assign(tiles_x * tiles_y * slices, Cluster());
+	indices.clear();
+	for (uint32_t z = 0; z < slices; ++z) {
+		for (uint32_t y = 0; y < tiles_y; ++y) {
+			for (uint32_t x = 0; x < tiles_x; ++x) {
+				Cluster &cluster = clusters[cluster_index(x, y, z)];
+				cluster.offset = uint32_t(indices.size());
+				for (uint32_t l = 0; l < uint32_t(view_lights.size()); ++l) {
+					if (touches(view_lights[l], x, y, z)) indices.emplace_back(l);
+				}
+				cluster.count = uint32_t(indices.size()) - cluster.offset;
+			}
+		}
+	}
+
+	for (auto const &light : view_lights) {
+		float depth = -light.position.z;
+		if (depth + light.radius >= near && depth - light.radius <= far) stats.lights_in_range += 1;
+	}
+	stats.clusters_tested = uint32_t(clusters.size() * view_lights.size());
+	stats.assignments = uint32_t(indices.size());
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+/*
+ * LightClusters assigns point and spot lights to "froxels": a grid of
+ *  tiles_x * tiles_y screen tiles by 'slices' depth slices (exponentially
+ *  spaced between near and far) covering a perspective view frustum.
+ *
+ * The result is a compact list per cluster -- indices[offset .. offset+count) --
+ *  ready to upload (e.g., to buffer textures) for a clustered forward shader
+ *  that finds its cluster from gl_FragCoord and view depth.
+ *
+ * Lights are binned by the depth slices their bounding spheres touch; slices
+ *  are then processed in parallel on a WorkerPool, testing spheres against
+ *  cluster bounds four clusters at a time (SSE2 where available) and spot
+ *  cones against the survivors.
+ *
+ * assign_brute_force() tests every light against every cluster with the same
+ *  predicates, so its results should match assign() exactly (see scene-bench).
+ *
+ * This is CPU-only; it doesn't touch OpenGL.
+ *
+ */
+
+#include <glm/glm.hpp>
+
+#include <utility>
+#include <vector>
+#include <cstdint>
+
+struct WorkerPool;
+
+struct LightClusters {
+	LightClusters(uint32_t tiles_x = 16, uint32_t tiles_y = 9, uint32_t slices = 24);
+
+	//view depths covered by the slices (lights entirely beyond 'far' are not assigned):
+	float near = 0.1f;
+	float far = 200.0f;
+
+	struct Light {
+		glm::vec3 position = glm::vec3(0.0f); //world space
+		float radius = 0.0f; //range of the light
+		glm::vec3 direction = glm::vec3(0.0f, 0.0f,-1.0f); //(spot lights) world-space direction of the cone (unit length)
+		float cos_half_angle = -1.0f; //(spot lights) cosine of the cone's half-angle; -1 => point light
+	};
+
+	//assign lights to the clusters of the view described by 'world_to_view' (camera looking down -z) and a perspective projection:
+	// (if 'pool' is null, uses WorkerPool::shared())
+	void assign(glm::mat4x3 const &world_to_view, float fovy, float aspect, std::vector< Light > const &lights, WorkerPool *pool = nullptr);
+
+	//same result as assign(), computed by testing every light against every cluster (for checking):
+	void assign_brute_force(glm::mat4x3 const &world_to_view, float fovy, float aspect, std::vector< Light > const &lights);
+
+	//results -- lights of cluster c are indices[clusters[c].offset .. clusters[c].offset + clusters[c].count), in increasing order:
+	struct Cluster {
+		uint32_t offset = 0;
+		uint32_t count = 0;
+	};
+	std::vector< Cluster > clusters; //tiles_x * tiles_y * slices of them
+	std::vector< uint32_t > indices; //indices into the 'lights' passed to assign()
+
+	uint32_t cluster_index(uint32_t x, uint32_t y, uint32_t z) const { return x + tiles_x * (y + tiles_y * z); }
+	//slice containing view depth 'depth' (a shader would use the same formula):
+	uint32_t slice_of(float depth) const;
+
+	//use SSE2 code paths (if compiled in; turn off to compare against the scalar code):
+	bool simd = true;
+
+	//counters from the most recent assign():
+	struct Stats {
+		uint32_t lights_in_range = 0; //lights touching at least one slice
+		uint32_t clusters_tested = 0; //cluster bounds tested against light spheres
+		uint32_t assignments = 0; //== indices.size()
+	} stats;
+
+	//-- internals ---
+	uint32_t tiles_x, tiles_y, slices;
+
+	//view-space bounding boxes of the clusters, computed by setup():
+	// (rows are padded to a multiple of four with empty ranges, so they can be read four at a time)
+	uint32_t stride_x, stride_y;
+	std::vector< float > slice_depth; //slices + 1 depths; slice z spans view depths [slice_depth[z], slice_depth[z+1]]
+	std::vector< float > x_lo, x_hi; //[z * stride_x + x]
+	std::vector< float > y_lo, y_hi; //[z * stride_y + y]
+
+	//lights in view space:
+	struct ViewLight {
+		glm::vec3 position;
+		float radius;
+		glm::vec3 direction;
+		float cos_half_angle;
+		float sin_half_angle;
+	};
+	std::vector< ViewLight > view_lights;
+
+	//per-slice scratch space for assign():
+	struct SliceWork {
+		std::vector< uint32_t > lights; //lights whose depth range touches the slice (increasing order)
+		std::vector< std::pair< uint32_t, uint32_t > > pairs; //(cluster within slice, light) found
+		std::vector< float > dx2, dy2; //squared distances from the current light to each column/row of clusters
+		uint32_t tested = 0;
+	};
+	std::vector< SliceWork > slice_work;
+
+	void setup(glm::mat4x3 const &world_to_view, float fovy, float aspect, std::vector< Light > const &lights);
+	//does the light touch cluster (x, y, z)'s bounds? (sphere test, then cone test for spot lights)
+	bool touches(ViewLight const &light, uint32_t x, uint32_t y, uint32_t z) const;
+	bool cone_touches(ViewLight const &light, uint32_t x, uint32_t y, uint32_t z) const;
+};
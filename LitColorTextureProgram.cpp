@@ -1,27 +1,26 @@
 #include "LitColorTextureProgram.hpp"
 
+#include "Mesh.hpp"
 #include "gl_compile_program.hpp"
 #include "gl_errors.hpp"
 
+#include <unordered_map>
+
 Scene::Drawable::Pipeline lit_color_texture_program_pipeline;
 
 Load< LitColorTextureProgram > lit_color_texture_program(LoadTagEarly, []() -> LitColorTextureProgram const * {
-	LitColorTextureProgram *ret = new LitColorTextureProgram();
+	LitColorTextureProgram const *ret = &LitColorTextureProgram::variant(LitColorTextureProgram::Textured | LitColorTextureProgram::VertexColor);
 
 	//----- build the pipeline template -----
 	lit_color_texture_program_pipeline.program = ret->program;
 
-	lit_color_texture_program_pipeline.OBJECT_TO_CLIP_mat4 = ret->OBJECT_TO_CLIP_mat4;
-	lit_color_texture_program_pipeline.OBJECT_TO_LIGHT_mat4x3 = ret->OBJECT_TO_LIGHT_mat4x3;
-	lit_color_texture_program_pipeline.NORMAL_TO_LIGHT_mat3 = ret->NORMAL_TO_LIGHT_mat3;
+	//draw each drawable with the variant specialized for its features and the frame light's type:
+	lit_color_texture_program_pipeline.features = LitColorTextureProgram::Textured | LitColorTextureProgram::VertexColor;
+	lit_color_texture_program_pipeline.select_program = &LitColorTextureProgram::select_program;
 
-	/* This will be used later if/when we build a light loop into the Scene:
-	lit_color_texture_program_pipeline.LIGHT_TYPE_int = ret->LIGHT_TYPE_int;
-	lit_color_texture_program_pipeline.LIGHT_LOCATION_vec3 = ret->LIGHT_LOCATION_vec3;
-	lit_color_texture_program_pipeline.LIGHT_DIRECTION_vec3 = ret->LIGHT_DIRECTION_vec3;
-	lit_color_texture_program_pipeline.LIGHT_ENERGY_vec3 = ret->LIGHT_ENERGY_vec3;
-	lit_color_texture_program_pipeline.LIGHT_CUTOFF_float = ret->LIGHT_CUTOFF_float;
-	*/
+	//per-object matrices come from the 'Object' uniform block; lighting from the 'Frame' block (see Scene::frame_light)
+	// plus the scene's lights via the 'Lights' block and each object's light list (see Scene::light_lists):
+	lit_color_texture_program_pipeline.object_block = true;
 
 	//make a 1-pixel white texture to bind by default:
 	GLuint tex;
@@ -43,68 +42,195 @@ Load< LitColorTextureProgram > lit_color_texture_program(LoadTagEarly, []() -> L
 	return ret;
 });
 
-LitColorTextureProgram::LitColorTextureProgram() {
+Load< LitColorTextureProgram > lit_color_texture_instanced_program(LoadTagEarly, []() -> LitColorTextureProgram const * {
+	LitColorTextureProgram const *ret = &LitColorTextureProgram::variant(LitColorTextureProgram::Textured | LitColorTextureProgram::VertexColor | LitColorTextureProgram::Instanced);
+
+	//let Scene::draw batch copies of the same mesh through this program:
+	lit_color_texture_program_pipeline.instanced_program = ret->program;
+
+	return ret;
+});
+
+LitColorTextureProgram const &LitColorTextureProgram::variant(uint32_t features) {
+	//(the light type bits only mean something when fixed)
+	if (!(features & LightTypeFixed)) features &= ~LightTypeMask;
+
+	//(never freed -- like Load<> values, variants live until exit)
+	static std::unordered_map< uint32_t, LitColorTextureProgram const * > variants;
+	auto f = variants.find(features);
+	if (f == variants.end()) {
+		f = variants.emplace(features, new LitColorTextureProgram(features)).first;
+	}
+	return *f->second;
+}
+
+GLuint LitColorTextureProgram::select_program(uint32_t features, int32_t light_type, bool instanced) {
+	features &= (Textured | VertexColor | OctahedralNormals);
+	if (light_type >= 0 && light_type <= 3) features |= LightTypeFixed | uint32_t(light_type);
+	if (instanced) features |= Instanced;
+	return variant(features).program;
+}
+
+LitColorTextureProgram::LitColorTextureProgram(uint32_t features) {
+	bool instanced = (features & Instanced);
+
+	//the variant is selected by #defines at the top of both shaders:
+	std::string defines;
+	if (features & LightTypeFixed) defines += "#define FRAME_LIGHT_TYPE " + std::to_string(features & LightTypeMask) + "\n";
+	if (features & Textured) defines += "#define TEXTURED\n";
+	if (features & VertexColor) defines += "#define VERTEX_COLOR\n";
+	if (instanced) defines += "#define INSTANCED\n";
+	if (features & OctahedralNormals) defines += "#define OCTAHEDRAL_NORMALS\n";
+
 	//Compile vertex and fragment shaders using the convenient 'gl_compile_program' helper function:
 	program = gl_compile_program(
 		//vertex shader:
 		"#version 330\n"
-		"uniform mat4 OBJECT_TO_CLIP;\n"
-		"uniform mat4x3 OBJECT_TO_LIGHT;\n"
-		"uniform mat3 NORMAL_TO_LIGHT;\n"
-		"in vec4 Position;\n"
-		"in vec3 Normal;\n"
-		"in vec4 Color;\n"
-		"in vec2 TexCoord;\n"
+		//per-object matrices and light lists come from the 'Object' uniform block or (instanced) from a buffer texture:
+		// (layout of each instance's texels is described in Scene::draw)
+		"#ifdef INSTANCED\n"
+		"uniform samplerBuffer INSTANCES;\n"
+		"mat4 OBJECT_TO_CLIP;\n"
+		"mat4x3 OBJECT_TO_LIGHT;\n"
+		"mat3 NORMAL_TO_LIGHT;\n"
+		"int LIGHT_COUNT;\n"
+		"ivec4 LIGHT_INDICES[2];\n"
+		"void fetch_instance() {\n"
+		"	int base = gl_InstanceID * 14;\n"
+		"	OBJECT_TO_CLIP = mat4(texelFetch(INSTANCES, base+0), texelFetch(INSTANCES, base+1), texelFetch(INSTANCES, base+2), texelFetch(INSTANCES, base+3));\n"
+		"	OBJECT_TO_LIGHT = mat4x3(texelFetch(INSTANCES, base+4).xyz, texelFetch(INSTANCES, base+5).xyz, texelFetch(INSTANCES, base+6).xyz, texelFetch(INSTANCES, base+7).xyz);\n"
+		"	NORMAL_TO_LIGHT = mat3(texelFetch(INSTANCES, base+8).xyz, texelFetch(INSTANCES, base+9).xyz, texelFetch(INSTANCES, base+10).xyz);\n"
+		"	vec4 l0 = texelFetch(INSTANCES, base+11);\n"
+		"	vec4 l1 = texelFetch(INSTANCES, base+12);\n"
+		"	vec4 l2 = texelFetch(INSTANCES, base+13);\n"
+		"	LIGHT_COUNT = int(l0.x);\n"
+		"	LIGHT_INDICES[0] = ivec4(l0.yzw, l1.x);\n"
+		"	LIGHT_INDICES[1] = ivec4(l1.yzw, l2.x);\n"
+		"}\n"
+		"#else\n"
+		+ std::string(Scene::ObjectBlockGLSL) +
+		"#endif\n"
+		//(fixed locations, so every variant works with the same vertex array object)
+		"layout(location=0) in vec4 Position;\n"
+		"#ifdef OCTAHEDRAL_NORMALS\n"
+		"layout(location=1) in vec2 Normal;\n"
+		+ std::string(MeshBuffer::OctahedralNormalGLSL) +
+		"#else\n"
+		"layout(location=1) in vec3 Normal;\n"
+		"#endif\n"
+		"layout(location=2) in vec4 Color;\n"
+		"layout(location=3) in vec2 TexCoord;\n"
 		"out vec3 position;\n"
 		"out vec3 normal;\n"
+		"#ifdef VERTEX_COLOR\n"
 		"out vec4 color;\n"
+		"#endif\n"
+		"#ifdef TEXTURED\n"
 		"out vec2 texCoord;\n"
+		"#endif\n"
+		"flat out int lightCount;\n"
+		"flat out ivec4 lightIndices[2];\n"
 		"void main() {\n"
+		"#ifdef INSTANCED\n"
+		"	fetch_instance();\n"
+		"#endif\n"
 		"	gl_Position = OBJECT_TO_CLIP * Position;\n"
 		"	position = OBJECT_TO_LIGHT * Position;\n"
+		"#ifdef OCTAHEDRAL_NORMALS\n"
+		"	normal = NORMAL_TO_LIGHT * octahedral_normal(Normal);\n"
+		"#else\n"
 		"	normal = NORMAL_TO_LIGHT * Normal;\n"
+		"#endif\n"
+		"#ifdef VERTEX_COLOR\n"
 		"	color = Color;\n"
+		"#endif\n"
+		"#ifdef TEXTURED\n"
 		"	texCoord = TexCoord;\n"
+		"#endif\n"
+		"	lightCount = LIGHT_COUNT;\n"
+		"	lightIndices[0] = LIGHT_INDICES[0];\n"
+		"	lightIndices[1] = LIGHT_INDICES[1];\n"
 		"}\n"
 	,
 		//fragment shader:
 		"#version 330\n"
-		"uniform sampler2D TEX;\n"
-		"uniform int LIGHT_TYPE;\n"
-		"uniform vec3 LIGHT_LOCATION;\n"
-		"uniform vec3 LIGHT_DIRECTION;\n"
-		"uniform vec3 LIGHT_ENERGY;\n"
-		"uniform float LIGHT_CUTOFF;\n"
+		+ std::string(Scene::FrameBlockGLSL)
+		+ std::string(Scene::LightsBlockGLSL) +
 		"in vec3 position;\n"
 		"in vec3 normal;\n"
+		"#ifdef VERTEX_COLOR\n"
 		"in vec4 color;\n"
+		"#endif\n"
+		"#ifdef TEXTURED\n"
+		"uniform sampler2D TEX;\n"
 		"in vec2 texCoord;\n"
+		"#endif\n"
+		"flat in int lightCount;\n"
+		"flat in ivec4 lightIndices[2];\n"
 		"out vec4 fragColor;\n"
+		"vec3 light_energy(int type, vec3 location, vec3 direction, float cutoff, vec3 energy, float range, vec3 n) {\n"
+		"	if (type == 1) { //hemi light \n"
+		"		return (dot(n,-direction) * 0.5 + 0.5) * energy;\n"
+		"	} else if (type == 3) { //directional light \n"
+		"		return max(0.0, dot(n,-direction)) * energy;\n"
+		"	}\n"
+		"	//point or spot light: \n"
+		"	vec3 l = (location - position);\n"
+		"	float dis2 = dot(l,l);\n"
+		"	l = normalize(l);\n"
+		"	float nl = max(0.0, dot(n, l)) / max(1.0, dis2);\n"
+		"	if (range > 0.0) { //fade to zero at range, so culled lights don't pop \n"
+		"		float f = clamp(1.0 - (dis2 * dis2) / (range * range * range * range), 0.0, 1.0);\n"
+		"		nl *= f * f;\n"
+		"	}\n"
+		"	if (type == 2) { //spot light \n"
+		"		float c = dot(l,-direction);\n"
+		"		nl *= smoothstep(cutoff,mix(cutoff,1.0,0.1), c);\n"
+		"	}\n"
+		"	return nl * energy;\n"
+		"}\n"
+		//the 'Frame' block's light, with its type compiled in when known:
+		"vec3 frame_light_energy(vec3 n) {\n"
+		"#if !defined(FRAME_LIGHT_TYPE)\n"
+		"	return light_energy(LIGHT_TYPE, LIGHT_LOCATION, LIGHT_DIRECTION, LIGHT_CUTOFF, LIGHT_ENERGY, 0.0, n);\n"
+		"#elif FRAME_LIGHT_TYPE == 1 //hemi light \n"
+		"	return (dot(n,-LIGHT_DIRECTION) * 0.5 + 0.5) * LIGHT_ENERGY;\n"
+		"#elif FRAME_LIGHT_TYPE == 3 //directional light \n"
+		"	return max(0.0, dot(n,-LIGHT_DIRECTION)) * LIGHT_ENERGY;\n"
+		"#else //point or spot light \n"
+		"	vec3 l = (LIGHT_LOCATION - position);\n"
+		"	float dis2 = dot(l,l);\n"
+		"	l = normalize(l);\n"
+		"	float nl = max(0.0, dot(n, l)) / max(1.0, dis2);\n"
+		"#if FRAME_LIGHT_TYPE == 2 //spot light \n"
+		"	nl *= smoothstep(LIGHT_CUTOFF,mix(LIGHT_CUTOFF,1.0,0.1), dot(l,-LIGHT_DIRECTION));\n"
+		"#endif\n"
+		"	return nl * LIGHT_ENERGY;\n"
+		"#endif\n"
+		"}\n"
 		"void main() {\n"
 		"	vec3 n = normalize(normal);\n"
-		"	vec3 e;\n"
-		"	if (LIGHT_TYPE == 0) { //point light \n"
-		"		vec3 l = (LIGHT_LOCATION - position);\n"
-		"		float dis2 = dot(l,l);\n"
-		"		l = normalize(l);\n"
-		"		float nl = max(0.0, dot(n, l)) / max(1.0, dis2);\n"
-		"		e = nl * LIGHT_ENERGY;\n"
-		"	} else if (LIGHT_TYPE == 1) { //hemi light \n"
-		"		e = (dot(n,-LIGHT_DIRECTION) * 0.5 + 0.5) * LIGHT_ENERGY;\n"
-		"	} else if (LIGHT_TYPE == 2) { //spot light \n"
-		"		vec3 l = (LIGHT_LOCATION - position);\n"
-		"		float dis2 = dot(l,l);\n"
-		"		l = normalize(l);\n"
-		"		float nl = max(0.0, dot(n, l)) / max(1.0, dis2);\n"
-		"		float c = dot(l,-LIGHT_DIRECTION);\n"
-		"		nl *= smoothstep(LIGHT_CUTOFF,mix(LIGHT_CUTOFF,1.0,0.1), c);\n"
-		"		e = nl * LIGHT_ENERGY;\n"
-		"	} else { //(LIGHT_TYPE == 3) //directional light \n"
-		"		e = max(0.0, dot(n,-LIGHT_DIRECTION)) * LIGHT_ENERGY;\n"
+		"	vec3 e = frame_light_energy(n);\n"
+		//(list lights mix types, so their type is still read per light)
+		"	for (int i = 0; i < GLOBAL_LIGHT_COUNT; ++i) {\n"
+		"		SceneLight light = LIGHTS[i];\n"
+		"		e += light_energy(int(light.LOCATION_TYPE.w), light.LOCATION_TYPE.xyz, light.DIRECTION_CUTOFF.xyz, light.DIRECTION_CUTOFF.w, light.ENERGY_RANGE.rgb, light.ENERGY_RANGE.w, n);\n"
+		"	}\n"
+		"	for (int i = 0; i < lightCount; ++i) {\n"
+		"		SceneLight light = LIGHTS[lightIndices[i / 4][i % 4]];\n"
+		"		e += light_energy(int(light.LOCATION_TYPE.w), light.LOCATION_TYPE.xyz, light.DIRECTION_CUTOFF.xyz, light.DIRECTION_CUTOFF.w, light.ENERGY_RANGE.rgb, light.ENERGY_RANGE.w, n);\n"
 		"	}\n"
-		"	vec4 albedo = texture(TEX, texCoord) * color;\n"
+		"	vec4 albedo = vec4(1.0);\n"
+		"#ifdef TEXTURED\n"
+		"	albedo *= texture(TEX, texCoord);\n"
+		"#endif\n"
+		"#ifdef VERTEX_COLOR\n"
+		"	albedo *= color;\n"
+		"#endif\n"
 		"	fragColor = vec4(e*albedo.rgb, albedo.a);\n"
 		"}\n"
+	,
+		defines
 	);
 	//As you can see above, adjacent strings in C/C++ are concatenated.
 	// this is very useful for writing long shader programs inline.
@@ -115,29 +241,28 @@ LitColorTextureProgram::LitColorTextureProgram() {
 	Color_vec4 = glGetAttribLocation(program, "Color");
 	TexCoord_vec2 = glGetAttribLocation(program, "TexCoord");
 
-	//look up the locations of uniforms:
-	OBJECT_TO_CLIP_mat4 = glGetUniformLocation(program, "OBJECT_TO_CLIP");
-	OBJECT_TO_LIGHT_mat4x3 = glGetUniformLocation(program, "OBJECT_TO_LIGHT");
-	NORMAL_TO_LIGHT_mat3 = glGetUniformLocation(program, "NORMAL_TO_LIGHT");
-
-	LIGHT_TYPE_int = glGetUniformLocation(program, "LIGHT_TYPE");
-	LIGHT_LOCATION_vec3 = glGetUniformLocation(program, "LIGHT_LOCATION");
-	LIGHT_DIRECTION_vec3 = glGetUniformLocation(program, "LIGHT_DIRECTION");
-	LIGHT_ENERGY_vec3 = glGetUniformLocation(program, "LIGHT_ENERGY");
-	LIGHT_CUTOFF_float = glGetUniformLocation(program, "LIGHT_CUTOFF");
-
+	//attach uniform blocks to the binding points Scene::draw fills:
+	Scene::bind_uniform_blocks(program);
 
 	GLuint TEX_sampler2D = glGetUniformLocation(program, "TEX");
 
 	//set TEX to always refer to texture binding zero:
 	glUseProgram(program); //bind program -- glUniform* calls refer to this program now
 
-	glUniform1i(TEX_sampler2D, 0); //set TEX to sample from GL_TEXTURE0
+	if (TEX_sampler2D != -1U) {
+		glUniform1i(TEX_sampler2D, 0); //set TEX to sample from GL_TEXTURE0
+	}
+
+	if (instanced) {
+		GLuint INSTANCES_samplerBuffer = glGetUniformLocation(program, "INSTANCES");
+		glUniform1i(INSTANCES_samplerBuffer, Scene::InstanceTextureUnit); //set INSTANCES to sample from the unit Scene::draw binds instance data to
+	}
 
 	glUseProgram(0); //unbind program -- glUniform* calls refer to ??? now
 }
 
 LitColorTextureProgram::~LitColorTextureProgram() {
+	MeshBuffer::forget_program(program);
 	glDeleteProgram(program);
 	program = 0;
 }
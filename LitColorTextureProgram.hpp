@@ -5,36 +5,49 @@
 #include "Scene.hpp"
 
 //Shader program that draws transformed, lit, textured vertices tinted with vertex colors:
+// (the 'Instanced' variant reads per-object matrices from a buffer texture, indexed by gl_InstanceID)
+// Each combination of Features is compiled from the same source with #defines, so a variant only
+// contains the work it needs -- e.g., a variant for a hemisphere frame light has no per-fragment light type branch.
 struct LitColorTextureProgram {
-	LitColorTextureProgram();
+	enum Features : uint32_t {
+		LightTypeMask = 0x3, //frame light type compiled in (as Scene::FrameLight::type), if LightTypeFixed
+		LightTypeFixed = 0x4, //(otherwise LIGHT_TYPE is read from the 'Frame' block and branched on)
+		Textured = 0x8, //multiply by TEX (otherwise TEX is never sampled)
+		VertexColor = 0x10, //multiply by the Color attribute (otherwise it is ignored)
+		Instanced = 0x20, //per-object data from the instance buffer texture instead of the 'Object' block
+		OctahedralNormals = 0x40, //Normal is a vec2, decoded as in MeshBuffer::OctahedralNormalGLSL (for quantized meshes)
+	};
+	LitColorTextureProgram(uint32_t features = Textured | VertexColor);
 	~LitColorTextureProgram();
 
+	//the program for 'features', compiled on first request and kept for the rest of the run:
+	static LitColorTextureProgram const &variant(uint32_t features);
+	//variant selection for Scene::Drawable::Pipeline::select_program ('features' are Textured / VertexColor / OctahedralNormals):
+	static GLuint select_program(uint32_t features, int32_t light_type, bool instanced);
+
 	GLuint program = 0;
 
 	//Attribute (per-vertex variable) locations:
+	// (these are the same in every variant -- fixed with layout qualifiers -- so one vertex array object serves them all;
+	//  attributes a variant doesn't use are -1U. OctahedralNormals must match the mesh buffer's format.)
 	GLuint Position_vec4 = -1U;
 	GLuint Normal_vec3 = -1U;
 	GLuint Color_vec4 = -1U;
 	GLuint TexCoord_vec2 = -1U;
 
-	//Uniform (per-invocation variable) locations:
-	GLuint OBJECT_TO_CLIP_mat4 = -1U;
-	GLuint OBJECT_TO_LIGHT_mat4x3 = -1U;
-	GLuint NORMAL_TO_LIGHT_mat3 = -1U;
-
-	//lighting:
-	GLuint LIGHT_TYPE_int = -1U;
-	GLuint LIGHT_LOCATION_vec3 = -1U;
-	GLuint LIGHT_DIRECTION_vec3 = -1U;
-	GLuint LIGHT_ENERGY_vec3 = -1U;
-	GLuint LIGHT_CUTOFF_float = -1U;
-	
+	//Uniform blocks:
+	//Object - OBJECT_TO_CLIP, OBJECT_TO_LIGHT, NORMAL_TO_LIGHT (non-instanced variants only; see Scene::ObjectBlockGLSL)
+	//Frame - LIGHT_TYPE, LIGHT_LOCATION, LIGHT_DIRECTION, LIGHT_ENERGY, LIGHT_CUTOFF (set via Scene::frame_light; see Scene::FrameBlockGLSL)
+
 	//Textures:
-	//TEXTURE0 - texture that is accessed by TexCoord
+	//TEXTURE0 - texture that is accessed by TexCoord (Textured variants only)
+	//TEXTURE4 - (Instanced variants only) GL_TEXTURE_BUFFER of per-instance matrices (see Scene::InstanceTextureUnit)
 };
 
 extern Load< LitColorTextureProgram > lit_color_texture_program;
+extern Load< LitColorTextureProgram > lit_color_texture_instanced_program;
 
 //For convenient scene-graph setup, copy this object:
-// NOTE: by default, has texture bound to 1-pixel white texture -- so it's okay to use with vertex-color-only meshes.
+// NOTE: by default, has texture bound to 1-pixel white texture -- so it's okay to use with vertex-color-only meshes
+//  (though clearing LitColorTextureProgram::Textured from 'features' skips sampling it).
 extern Scene::Drawable::Pipeline lit_color_texture_program_pipeline;
@@ -151,7 +151,16 @@ const common_names = [
 	maek.CPP('DrawLines.cpp'),
 	maek.CPP('ColorProgram.cpp'),
 	maek.CPP('Scene.cpp'),
+	maek.CPP('MappedFile.cpp'),
+	maek.CPP('SceneInstance.cpp'),
+	maek.CPP('Frustum.cpp'),
+	maek.CPP('DrawableBVH.cpp'),
+	maek.CPP('OcclusionBuffer.cpp'),
+	maek.CPP('LightClusters.cpp'),
+	maek.CPP('WorkerPool.cpp'),
 	maek.CPP('Mesh.cpp'),
+	maek.CPP('AsyncLoader.cpp'),
+	maek.CPP('StreamingScene.cpp'),
 	maek.CPP('load_save_png.cpp'),
 	maek.CPP('gl_compile_program.cpp'),
 	maek.CPP('Mode.cpp'),
@@ -171,6 +180,27 @@ const show_scene_names = [
 	maek.CPP('ShowSceneMode.cpp')
 ];
 
+const scene_bench_names = [
+	maek.CPP('scene-bench.cpp'),
+	maek.CPP('TransformArrays.cpp') //(only the benchmark uses this, as a point of comparison)
+];
+
+const partition_scene_names = [
+	maek.CPP('partition-scene.cpp')
+];
+
+const index_meshes_names = [
+	maek.CPP('index-meshes.cpp')
+];
+
+const optimize_meshes_names = [
+	maek.CPP('optimize-meshes.cpp')
+];
+
+const quantize_meshes_names = [
+	maek.CPP('quantize-meshes.cpp')
+];
+
 const freetype_test_names = [
 	maek.CPP('freetype-test.cpp')
 ];
@@ -183,10 +213,17 @@ const game_exe = maek.LINK([...game_names, ...common_names, ...data_path_names],
 const show_meshes_exe = maek.LINK([...show_meshes_names, ...common_names, ...data_path_names], 'scenes/show-meshes');
 const show_scene_exe = maek.LINK([...show_scene_names, ...common_names, ...data_path_names], 'scenes/show-scene');
 
+const scene_bench_exe = maek.LINK([...scene_bench_names, ...common_names, ...data_path_names], 'scene-bench');
+
+const partition_scene_exe = maek.LINK([...partition_scene_names], 'scenes/partition-scene');
+const index_meshes_exe = maek.LINK([...index_meshes_names], 'scenes/index-meshes');
+const optimize_meshes_exe = maek.LINK([...optimize_meshes_names], 'scenes/optimize-meshes');
+const quantize_meshes_exe = maek.LINK([...quantize_meshes_names], 'scenes/quantize-meshes');
+
 const freetype_test_exe = maek.LINK([...freetype_test_names, ...data_path_names], 'freetype-test');
 
 //set the default target to the game (and copy the readme files):
-maek.TARGETS = [game_exe, show_meshes_exe, show_scene_exe, freetype_test_exe, ...copies];
+maek.TARGETS = [game_exe, show_meshes_exe, show_scene_exe, scene_bench_exe, partition_scene_exe, index_meshes_exe, optimize_meshes_exe, quantize_meshes_exe, freetype_test_exe, ...copies];
 
 //Note that tasks that produce ':abstract targets' are never cached.
 // This is similar to how .PHONY targets behave in make.
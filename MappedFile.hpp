@@ -0,0 +1,34 @@
+#pragma once
+
+/*
+ * MappedFile maps a whole file read-only into memory (mmap on posix,
+ *  MapViewOfFile on windows), so loaders can read data in place instead of
+ *  copying it through a stream.
+ *
+ * Keep the MappedFile alive (e.g., via std::shared_ptr) for as long as
+ *  anything points into its data.
+ *
+ */
+
+#include <string>
+#include <cstddef>
+
+struct MappedFile {
+	//map 'filename'; throws on failure:
+	MappedFile(std::string const &filename);
+	~MappedFile();
+
+	char const *data() const { return data_; }
+	size_t size() const { return size_; }
+
+	MappedFile(MappedFile const &) = delete;
+	MappedFile &operator=(MappedFile const &) = delete;
+
+	//-- internals ---
+	char const *data_ = nullptr;
+	size_t size_ = 0;
+	#ifdef _WIN32
+	void *file = nullptr; //HANDLE
+	void *mapping = nullptr; //HANDLE
+	#endif
+};
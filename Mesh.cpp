@@ -1,5 +1,6 @@
 #include "Mesh.hpp"
 #include "read_write_chunk.hpp"
+#include "lod_name.hpp"
 
 #include <glm/glm.hpp>
 
@@ -8,11 +9,68 @@
 #include <iostream>
 #include <vector>
 #include <string>
-#include <set>
+#include <algorithm>
 #include <cstddef>
+#include <cstring>
 
-MeshBuffer::MeshBuffer(std::string const &filename) {
-	glGenBuffers(1, &buffer);
+MeshBuffer::MeshBuffer(std::string const &filename, bool position_stream) : MeshBuffer(read(filename, position_stream)) {
+}
+
+char const *MeshBuffer::OctahedralNormalGLSL =
+	"vec3 octahedral_normal(vec2 e) {\n"
+	"	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));\n"
+	"	if (n.z < 0.0) n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);\n"
+	"	return normalize(n);\n"
+	"}\n";
+
+MeshBuffer::MeshBuffer(Data const &data, GLuint buffer_, GLuint index_buffer_, GLuint position_buffer_) : buffer(buffer_), index_buffer(index_buffer_), index_type(data.index_type), position_buffer(position_buffer_), quantized(data.quantized) {
+	if (buffer == 0) {
+		//upload data:
+		glGenBuffers(1, &buffer);
+		glBindBuffer(GL_ARRAY_BUFFER, buffer);
+		glBufferData(GL_ARRAY_BUFFER, data.vertices.size(), data.vertices.data(), GL_STATIC_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+	if (index_buffer == 0 && data.index_type != GL_NONE) {
+		//(element buffers can be filled without a vertex array object bound by going through another target)
+		glGenBuffers(1, &index_buffer);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, index_buffer);
+		glBufferData(GL_COPY_WRITE_BUFFER, data.indices.size(), data.indices.data(), GL_STATIC_DRAW);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	}
+	if (position_buffer == 0 && !data.positions.empty()) {
+		glGenBuffers(1, &position_buffer);
+		glBindBuffer(GL_ARRAY_BUFFER, position_buffer);
+		glBufferData(GL_ARRAY_BUFFER, data.positions.size(), data.positions.data(), GL_STATIC_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+	Position = data.Position;
+	Normal = data.Normal;
+	Color = data.Color;
+	TexCoord = data.TexCoord;
+	PositionOnly = data.PositionOnly;
+	meshes = data.meshes;
+
+	/* //DEBUG:
+	std::cout << "Buffer contained meshes";
+	for (auto const &m : meshes) {
+		if (&m.second == &meshes.rbegin()->second && meshes.size() > 1) std::cout << " and";
+		std::cout << " '" << m.first << "'";
+		if (&m.second != &meshes.rbegin()->second) std::cout << ",";
+	}
+	std::cout << std::endl;
+	*/
+}
+
+MeshBuffer::~MeshBuffer() {
+	for (auto const &layout_vao : vao_for_layout) {
+		glDeleteVertexArrays(1, &layout_vao.second);
+	}
+}
+
+MeshBuffer::Data MeshBuffer::read(std::string const &filename, bool position_stream) {
+	Data ret;
 
 	std::ifstream file(filename, std::ios::binary);
 
@@ -25,24 +83,67 @@ MeshBuffer::MeshBuffer(std::string const &filename) {
 		glm::vec2 TexCoord;
 	};
 	static_assert(sizeof(Vertex) == 3*4+3*4+4*1+2*4, "Vertex is packed.");
-	std::vector< Vertex > data;
 
-	//read + upload data chunk:
+	//quantized vertex format:
+	struct QuantizedVertex {
+		glm::u16vec4 Position; //.xyz: normalized position within the mesh's box; .w: unused
+		glm::i16vec2 Normal; //octahedral-encoded normal (normalized)
+		glm::u8vec4 Color;
+		glm::u16vec2 TexCoord; //half floats
+	};
+	static_assert(sizeof(QuantizedVertex) == 2*4+2*2+4*1+2*2, "QuantizedVertex is packed.");
+
+	//vertex positions, before dequantization (used for bounds below):
+	auto position = [&](uint32_t v) {
+		if (ret.quantized) {
+			glm::u16vec4 q;
+			std::memcpy(&q, ret.vertices.data() + v * sizeof(QuantizedVertex) + offsetof(QuantizedVertex, Position), sizeof(q));
+			return glm::vec3(q) / 65535.0f;
+		}
+		glm::vec3 ret_position;
+		std::memcpy(&ret_position, ret.vertices.data() + v * sizeof(Vertex) + offsetof(Vertex, Position), sizeof(ret_position));
+		return ret_position;
+	};
+
+	//read data chunk:
 	if (filename.size() >= 5 && filename.substr(filename.size()-5) == ".pnct") {
-		read_chunk(file, "pnct", &data);
+		//quantized files start with a 'pnq0' chunk instead:
+		char magic[4] = {'\0', '\0', '\0', '\0'};
+		file.read(magic, 4);
+		file.seekg(0);
+		ret.quantized = (std::string(magic, 4) == "pnq0");
 
-		//upload data:
-		glBindBuffer(GL_ARRAY_BUFFER, buffer);
-		glBufferData(GL_ARRAY_BUFFER, data.size() * sizeof(Vertex), data.data(), GL_STATIC_DRAW);
-		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		//(read as bytes, so the data can go straight to glBufferData later)
+		read_chunk(file, (ret.quantized ? "pnq0" : "pnct"), &ret.vertices);
+		size_t vertex_size = (ret.quantized ? sizeof(QuantizedVertex) : sizeof(Vertex));
+		if (ret.vertices.size() % vertex_size != 0) {
+			throw std::runtime_error("Size of chunk not divisible by element size");
+		}
 
-		total = GLuint(data.size()); //store total for later checks on index
+		total = GLuint(ret.vertices.size() / vertex_size); //store total for later checks on index
 
 		//store attrib locations:
-		Position = Attrib(3, GL_FLOAT, GL_FALSE, sizeof(Vertex), offsetof(Vertex, Position));
-		Normal = Attrib(3, GL_FLOAT, GL_FALSE, sizeof(Vertex), offsetof(Vertex, Normal));
-		Color = Attrib(4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Vertex), offsetof(Vertex, Color));
-		TexCoord = Attrib(2, GL_FLOAT, GL_FALSE, sizeof(Vertex), offsetof(Vertex, TexCoord));
+		if (ret.quantized) {
+			ret.Position = Attrib(3, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(QuantizedVertex), offsetof(QuantizedVertex, Position));
+			ret.Normal = Attrib(2, GL_SHORT, GL_TRUE, sizeof(QuantizedVertex), offsetof(QuantizedVertex, Normal));
+			ret.Color = Attrib(4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(QuantizedVertex), offsetof(QuantizedVertex, Color));
+			ret.TexCoord = Attrib(2, GL_HALF_FLOAT, GL_FALSE, sizeof(QuantizedVertex), offsetof(QuantizedVertex, TexCoord));
+		} else {
+			ret.Position = Attrib(3, GL_FLOAT, GL_FALSE, sizeof(Vertex), offsetof(Vertex, Position));
+			ret.Normal = Attrib(3, GL_FLOAT, GL_FALSE, sizeof(Vertex), offsetof(Vertex, Normal));
+			ret.Color = Attrib(4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Vertex), offsetof(Vertex, Color));
+			ret.TexCoord = Attrib(2, GL_FLOAT, GL_FALSE, sizeof(Vertex), offsetof(Vertex, TexCoord));
+		}
+
+		if (position_stream) {
+			//copy out just the positions (all four shorts of quantized positions, to keep them 4-byte aligned):
+			size_t position_size = (ret.quantized ? sizeof(QuantizedVertex::Position) : sizeof(Vertex::Position));
+			ret.positions.resize(total * position_size);
+			for (size_t v = 0; v < total; ++v) {
+				std::memcpy(ret.positions.data() + v * position_size, ret.vertices.data() + v * vertex_size + ret.Position.offset, position_size);
+			}
+			ret.PositionOnly = Attrib(ret.Position.size, ret.Position.type, ret.Position.normalized, GLsizei(position_size), 0);
+		}
 	} else {
 		throw std::runtime_error("Unknown file type '" + filename + "'");
 	}
@@ -60,11 +161,50 @@ MeshBuffer::MeshBuffer(std::string const &filename) {
 		std::vector< IndexEntry > index;
 		read_chunk(file, "idx0", &index);
 
-		for (auto const &entry : index) {
+		//(quantized files) each mesh's position box:
+		struct BoxEntry {
+			glm::vec3 offset;
+			glm::vec3 scale;
+		};
+		static_assert(sizeof(BoxEntry) == 4*3 + 4*3, "Box entry should be packed");
+
+		std::vector< BoxEntry > boxes;
+		if (ret.quantized) {
+			read_chunk(file, "qbx0", &boxes);
+			if (boxes.size() != index.size()) throw std::runtime_error("box chunk doesn't match index chunk");
+		}
+
+		//(optional) element chunk -- if present, index entries are ranges of elements rather than of vertices:
+		// (anything else after the index chunk is trailing data, reported below)
+		std::vector< uint32_t > elements;
+		bool indexed = next_chunk_is(file, "elm0");
+		if (indexed) {
+			read_chunk(file, "elm0", &elements);
+			for (uint32_t e : elements) {
+				if (e >= total) throw std::runtime_error("element chunk refers to out-of-range vertex");
+			}
+			//store as 16-bit elements where possible (half the index fetch bandwidth):
+			if (total <= 0x10000) {
+				ret.index_type = GL_UNSIGNED_SHORT;
+				ret.indices.resize(elements.size() * sizeof(uint16_t));
+				for (size_t i = 0; i < elements.size(); ++i) {
+					uint16_t e = uint16_t(elements[i]);
+					std::memcpy(ret.indices.data() + i * sizeof(uint16_t), &e, sizeof(uint16_t));
+				}
+			} else {
+				ret.index_type = GL_UNSIGNED_INT;
+				ret.indices.resize(elements.size() * sizeof(uint32_t));
+				std::memcpy(ret.indices.data(), elements.data(), ret.indices.size());
+			}
+		}
+		GLuint range_limit = (indexed ? GLuint(elements.size()) : total);
+
+		for (size_t i = 0; i < index.size(); ++i) {
+			IndexEntry const &entry = index[i];
 			if (!(entry.name_begin <= entry.name_end && entry.name_end <= strings.size())) {
 				throw std::runtime_error("index entry has out-of-range name begin/end");
 			}
-			if (!(entry.vertex_begin <= entry.vertex_end && entry.vertex_end <= total)) {
+			if (!(entry.vertex_begin <= entry.vertex_end && entry.vertex_end <= range_limit)) {
 				throw std::runtime_error("index entry has out-of-range vertex start/count");
 			}
 			std::string name(&strings[0] + entry.name_begin, &strings[0] + entry.name_end);
@@ -72,11 +212,17 @@ MeshBuffer::MeshBuffer(std::string const &filename) {
 			mesh.type = GL_TRIANGLES;
 			mesh.start = entry.vertex_begin;
 			mesh.count = entry.vertex_end - entry.vertex_begin;
-			for (uint32_t v = entry.vertex_begin; v < entry.vertex_end; ++v) {
-				mesh.min = glm::min(mesh.min, data[v].Position);
-				mesh.max = glm::max(mesh.max, data[v].Position);
+			mesh.index_type = ret.index_type;
+			if (ret.quantized) {
+				mesh.position_offset = boxes[i].offset;
+				mesh.position_scale = boxes[i].scale;
+			}
+			for (uint32_t e = entry.vertex_begin; e < entry.vertex_end; ++e) {
+				glm::vec3 p = mesh.position_offset + mesh.position_scale * position(indexed ? elements[e] : e);
+				mesh.min = glm::min(mesh.min, p);
+				mesh.max = glm::max(mesh.max, p);
 			}
-			bool inserted = meshes.insert(std::make_pair(name, mesh)).second;
+			bool inserted = ret.meshes.insert(std::make_pair(name, mesh)).second;
 			if (!inserted) {
 				std::cerr << "WARNING: mesh name '" + name + "' in filename '" + filename + "' collides with existing mesh." << std::endl;
 			}
@@ -87,15 +233,7 @@ MeshBuffer::MeshBuffer(std::string const &filename) {
 		std::cerr << "WARNING: trailing data in mesh file '" << filename << "'" << std::endl;
 	}
 
-	/* //DEBUG:
-	std::cout << "File '" << filename << "' contained meshes";
-	for (auto const &m : meshes) {
-		if (&m.second == &meshes.rbegin()->second && meshes.size() > 1) std::cout << " and";
-		std::cout << " '" << m.first << "'";
-		if (&m.second != &meshes.rbegin()->second) std::cout << ",";
-	}
-	std::cout << std::endl;
-	*/
+	return ret;
 }
 
 const Mesh &MeshBuffer::lookup(std::string const &name) const {
@@ -106,45 +244,130 @@ const Mesh &MeshBuffer::lookup(std::string const &name) const {
 	return f->second;
 }
 
+std::vector< Mesh const * > MeshBuffer::lookup_lods(std::string const &name) const {
+	std::vector< Mesh const * > lods;
+	for (uint32_t level = 1; ; ++level) {
+		auto f = meshes.find(lod_name(name, level));
+		if (f == meshes.end()) break;
+		lods.emplace_back(&f->second);
+	}
+	return lods;
+}
+
+bool MeshBuffer::is_lod_name(std::string const &name) {
+	return parse_lod_name(name) != 0;
+}
+
+std::unordered_map< GLuint, uint32_t > &MeshBuffer::program_serials() {
+	//(never freed, so programs deleted during static destruction can still be forgotten)
+	static auto *serials = new std::unordered_map< GLuint, uint32_t >();
+	return *serials;
+}
+
+void MeshBuffer::forget_program(GLuint program) {
+	program_serials()[program] += 1;
+}
+
 GLuint MeshBuffer::make_vao_for_program(GLuint program) const {
+	vao_stats.requests += 1;
+
+	uint32_t serial = 0;
+	{
+		auto s = program_serials().find(program);
+		if (s != program_serials().end()) serial = s->second;
+	}
+
+	//Already made one for this program?
+	auto f = vao_for_program.find(program);
+	if (f != vao_for_program.end() && f->second.first == serial) {
+		vao_stats.program_hits += 1;
+		return f->second.second;
+	}
+
+	//Find the program's active attributes:
+	struct Active {
+		std::string name;
+		GLenum type = 0;
+		GLint location = -1;
+	};
+	std::vector< Active > active;
+	{
+		GLint count = 0;
+		glGetProgramiv(program, GL_ACTIVE_ATTRIBUTES, &count);
+		assert(count >= 0 && "Doesn't makes sense to have negative active attributes.");
+		for (GLuint i = 0; i < GLuint(count); ++i) {
+			GLchar name[100];
+			GLint size = 0;
+			GLenum type = 0;
+			glGetActiveAttrib(program, i, 100, NULL, &size, &type, name);
+			name[99] = '\0';
+			active.emplace_back();
+			active.back().name = name;
+			active.back().type = type;
+			active.back().location = glGetAttribLocation(program, name);
+		}
+	}
+
+	//programs that read only positions (depth / shadow passes) can use the position-only buffer:
+	bool position_only = (position_buffer != 0 && !active.empty());
+	for (auto const &a : active) {
+		if (a.name != "Position") position_only = false;
+	}
+
+	//Work out where each attribute in this buffer would be bound:
+	Attrib const *attribs[4] = {
+		(position_only ? &PositionOnly : &Position),
+		(position_only ? nullptr : &Normal),
+		(position_only ? nullptr : &Color),
+		(position_only ? nullptr : &TexCoord),
+	};
+	char const *names[4] = { "Position", "Normal", "Color", "TexCoord" };
+	std::vector< GLint > layout(5, -1);
+	for (uint32_t i = 0; i < 4; ++i) {
+		if (attribs[i] == nullptr || attribs[i]->size == 0) continue; //don't bind empty attribs
+		layout[i] = glGetAttribLocation(program, names[i]); //(-1 for missing attribs, which aren't bound)
+	}
+	layout[4] = (position_only ? 1 : 0);
+
+	//Check that all active attributes will be bound:
+	for (auto const &a : active) {
+		if (a.location == -1 || std::find(layout.begin(), layout.begin() + 4, a.location) == layout.begin() + 4) {
+			throw std::runtime_error("ERROR: active attribute '" + a.name + "' in program is not bound.");
+		}
+		//(a vec3 Normal would silently get the two encoded components with z = 0)
+		if (quantized && a.name == "Normal" && a.type != GL_FLOAT_VEC2) {
+			throw std::runtime_error("ERROR: buffer has octahedral-encoded normals, but program's 'Normal' attribute is not a vec2 (see MeshBuffer::OctahedralNormalGLSL).");
+		}
+	}
+
+	//Already made one that binds the same way (e.g., for another variant of the same shader)?
+	auto l = vao_for_layout.find(layout);
+	if (l != vao_for_layout.end()) {
+		vao_stats.layout_hits += 1;
+		vao_for_program[program] = std::make_pair(serial, l->second);
+		return l->second;
+	}
+
 	//create a new vertex array object:
 	GLuint vao = 0;
 	glGenVertexArrays(1, &vao);
 	glBindVertexArray(vao);
 
-	//Try to bind all attributes in this buffer:
-	std::set< GLuint > bound;
-	glBindBuffer(GL_ARRAY_BUFFER, buffer);
-	auto bind_attribute = [&](char const *name, MeshBuffer::Attrib const &attrib) {
-		if (attrib.size == 0) return; //don't bind empty attribs
-		GLint location = glGetAttribLocation(program, name);
-		if (location == -1) return; //can't bind missing attribs
-		glVertexAttribPointer(location, attrib.size, attrib.type, attrib.normalized, attrib.stride, (GLbyte *)0 + attrib.offset);
-		glEnableVertexAttribArray(location);
-		bound.insert(location);
-	};
-	bind_attribute("Position", Position);
-	bind_attribute("Normal", Normal);
-	bind_attribute("Color", Color);
-	bind_attribute("TexCoord", TexCoord);
+	glBindBuffer(GL_ARRAY_BUFFER, (position_only ? position_buffer : buffer));
+	for (uint32_t i = 0; i < 4; ++i) {
+		if (layout[i] == -1) continue;
+		Attrib const &attrib = *attribs[i];
+		glVertexAttribPointer(GLuint(layout[i]), attrib.size, attrib.type, attrib.normalized, attrib.stride, (GLbyte *)0 + attrib.offset);
+		glEnableVertexAttribArray(GLuint(layout[i]));
+	}
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	//(element buffer binding is part of vertex array object state)
+	if (index_buffer != 0) glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer);
 	glBindVertexArray(0);
 
-	//Check that all active attributes were bound:
-	GLint active = 0;
-	glGetProgramiv(program, GL_ACTIVE_ATTRIBUTES, &active);
-	assert(active >= 0 && "Doesn't makes sense to have negative active attributes.");
-	for (GLuint i = 0; i < GLuint(active); ++i) {
-		GLchar name[100];
-		GLint size = 0;
-		GLenum type = 0;
-		glGetActiveAttrib(program, i, 100, NULL, &size, &type, name);
-		name[99] = '\0';
-		GLint location = glGetAttribLocation(program, name);
-		if (!bound.count(GLuint(location))) {
-			throw std::runtime_error("ERROR: active attribute '" + std::string(name) + "' in program is not bound.");
-		}
-	}
+	vao_stats.created += 1;
+	vao_for_layout.emplace(layout, vao);
+	vao_for_program[program] = std::make_pair(serial, vao);
 
 	return vao;
 }
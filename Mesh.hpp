@@ -7,21 +7,48 @@
  *  a single OpenGL array buffer. Individual meshes can be looked up by name
  *  using the MeshBuffer::lookup() function.
  *
+ * Mesh files may also be indexed (an 'elm0' chunk after the usual ones; see
+ *  scenes/index-meshes), in which case meshes are ranges of the MeshBuffer's
+ *  element buffer, drawn with glDrawElements, and vertices shared between
+ *  triangles are stored (and transformed) once.
+ *
+ * ...and/or quantized (a 'pnq0' chunk in place of 'pnct'; see
+ *  scenes/quantize-meshes), in which case vertices are 20 bytes instead of 36:
+ *  16-bit positions within a per-mesh box, octahedral-encoded 16-bit normals,
+ *  and half-float texture coordinates. Positions are scaled back by the
+ *  object matrices (Mesh::position_offset/position_scale, copied into the
+ *  drawable's pipeline); normals must be decoded by the vertex shader
+ *  (see MeshBuffer::OctahedralNormalGLSL).
+ *
+ * A MeshBuffer may also keep a second, position-only copy of its vertices
+ *  (see MeshBuffer::position_buffer), which make_vao_for_program uses for
+ *  programs that read nothing but Position -- so depth prepasses and shadow
+ *  maps fetch 12 (or, if quantized, 8) bytes per vertex instead of 36 (20).
+ *
  */
 
 #include "GL.hpp"
 #include <glm/glm.hpp>
 #include <map>
+#include <unordered_map>
 #include <limits>
 #include <string>
+#include <vector>
+#include <cstdint>
 
 
 struct Mesh {
 	//Meshes are vertex ranges (and primitive types) in their MeshBuffer:
 
 	GLenum type = GL_TRIANGLES; //type of primitives in mesh
-	GLuint start = 0; //index of first vertex
-	GLuint count = 0; //count of vertices
+	GLuint start = 0; //index of first vertex (or, if indexed, of first element)
+	GLuint count = 0; //count of vertices (or, if indexed, of elements)
+	GLenum index_type = GL_NONE; //if indexed: type of the MeshBuffer's elements (GL_UNSIGNED_SHORT or GL_UNSIGNED_INT)
+
+	//object-space position == position_offset + position_scale * (Position attribute)
+	// (identity unless the MeshBuffer is quantized):
+	glm::vec3 position_offset = glm::vec3(0.0f);
+	glm::vec3 position_scale = glm::vec3(1.0f);
 
 	//Bounding box.
 	//useful for debug visualization and (perhaps, eventually) collision detection:
@@ -32,24 +59,83 @@ struct Mesh {
 struct MeshBuffer {
 	//construct from a file:
 	// note: will throw if file fails to read.
-	MeshBuffer(std::string const &filename);
+	// ('position_stream' also keeps a position-only copy of the vertices -- see position_buffer)
+	MeshBuffer(std::string const &filename, bool position_stream = false);
+
+	//loading can also be split into a file-reading step that doesn't touch OpenGL (so can run on any thread)...
+	struct Data;
+	// note: will throw if file fails to read.
+	static Data read(std::string const &filename, bool position_stream = false);
+	//...and construction from that data on the OpenGL thread:
+	// (if 'buffer' is non-zero, it is adopted as already holding data.vertices; otherwise a buffer is created and filled)
+	// (likewise 'index_buffer' and data.indices, for indexed data, and 'position_buffer' and data.positions, if present)
+	MeshBuffer(Data const &data, GLuint buffer = 0, GLuint index_buffer = 0, GLuint position_buffer = 0);
+
+	//deletes the vertex array objects made by make_vao_for_program:
+	~MeshBuffer();
+	//(which is why this isn't copyable)
+	MeshBuffer(MeshBuffer const &) = delete;
+	MeshBuffer &operator=(MeshBuffer const &) = delete;
 
 	//look up a particular mesh by name:
 	// note: will throw if mesh not found.
 	const Mesh &lookup(std::string const &name) const;
+
+	//look up the coarser levels of detail of a mesh, which are stored as separate meshes named
+	// by convention "Name.LOD1", "Name.LOD2", ... (see lod_name.hpp; stops at the first missing level; may be empty):
+	std::vector< Mesh const * > lookup_lods(std::string const &name) const;
+	//is this the name of a coarser level of some other mesh? (scene loaders should skip these -- they're drawn via lookup_lods):
+	static bool is_lod_name(std::string const &name);
 	
 	//build a vertex array object that links this vbo to attributes to a program:
+	// (if the program reads only Position and there is a position_buffer, the vertex array object uses that instead)
 	// note: will throw if program defines attributes not contained in this buffer
+	//  (or, for a quantized buffer, if the program's Normal isn't the vec2 of octahedral-encoded normals)
+	// note: the vertex array object belongs to this MeshBuffer -- later calls for the same program (answered
+	//  without querying the program), or for any program whose attributes end up bound the same way, return the same one. Don't delete it.
+	// note: programs are remembered by name; call forget_program() when deleting one.
 	GLuint make_vao_for_program(GLuint program) const;
 
+	//note that 'program' is being deleted, so a later program given the same name isn't matched to it by any
+	// MeshBuffer's make_vao_for_program (call from program destructors, next to glDeleteProgram):
+	static void forget_program(GLuint program);
+
+	//make_vao_for_program counts (to check that vertex array objects are being shared):
+	struct VAOStats {
+		uint32_t requests = 0; //calls to make_vao_for_program
+		uint32_t program_hits = 0; //...returning the vertex array object from an earlier call with the same program
+		uint32_t layout_hits = 0; //...returning one made for a different program with the same attribute bindings
+		uint32_t created = 0; //...making a new vertex array object
+	};
+	mutable VAOStats vao_stats;
+
 	//This is the OpenGL vertex buffer object containing the mesh data:
 	GLuint buffer = 0;
+	//...and, for indexed meshes, the element buffer (bound into the vertex array objects made by make_vao_for_program):
+	GLuint index_buffer = 0;
+	GLenum index_type = GL_NONE;
+	//...and, if requested when loading, the deinterleaved position-only copy of the vertex data (0 otherwise):
+	GLuint position_buffer = 0;
+
+	//vertices are in the quantized format described above:
+	bool quantized = false;
+	//GLSL for decoding quantized normals in a vertex shader -- 'vec3 octahedral_normal(vec2 e)':
+	static char const *OctahedralNormalGLSL;
 
 	//-- internals ---
 
 	//used by the lookup() function:
 	std::map< std::string, Mesh > meshes;
 
+	//vertex array objects made by make_vao_for_program, by program and by attribute bindings:
+	// (a binding key is the location of each of Position, Normal, Color, TexCoord -- or -1 if unbound -- and then 1 if
+	//  position_buffer is used; every vertex array object is in vao_for_layout exactly once)
+	// (program entries hold the program's serial when cached -- see forget_program() -- and are ignored if it has changed)
+	mutable std::map< GLuint, std::pair< uint32_t, GLuint > > vao_for_program;
+	mutable std::map< std::vector< GLint >, GLuint > vao_for_layout;
+	//serial of each program name, bumped by forget_program():
+	static std::unordered_map< GLuint, uint32_t > &program_serials();
+
 	//These 'Attrib' structures describe the location of various attributes within the buffer (in exactly format wanted by glVertexAttribPointer). They are set when the file is loaded and are used by the "make_vao_for_program" call:
 	struct Attrib {
 		GLint size = 0;
@@ -67,4 +153,16 @@ struct MeshBuffer {
 	Attrib Normal;
 	Attrib Color;
 	Attrib TexCoord;
+	Attrib PositionOnly; //Position within position_buffer
+
+	//Everything read from a mesh file:
+	struct Data {
+		std::vector< uint8_t > vertices; //contents of the vertex buffer
+		std::vector< uint8_t > indices; //contents of the element buffer (empty if not indexed)
+		std::vector< uint8_t > positions; //contents of the position-only buffer (empty if not requested)
+		GLenum index_type = GL_NONE; //(16-bit elements when there are few enough vertices, 32-bit otherwise)
+		bool quantized = false;
+		Attrib Position, Normal, Color, TexCoord, PositionOnly;
+		std::map< std::string, Mesh > meshes;
+	};
 };
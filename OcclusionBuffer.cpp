@@ -0,0 +1,200 @@
+#include "OcclusionBuffer.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define OCCLUSION_SSE2 1
+#include <emmintrin.h>
+#else
+#define OCCLUSION_SSE2 0
+#endif
+
+OcclusionBuffer::OcclusionBuffer(uint32_t width_, uint32_t height_) : width((std::max(width_, 4U) + 3U) & ~3U), height(std::max(height_, 1U)) {
+	depth.resize(width * height);
+	clear();
+}
+
+void OcclusionBuffer::add_box_occluder(Scene::Transform const *transform, glm::vec3 const &min, glm::vec3 const &max) {
+	glm::vec3 c[8];
+	for (uint32_t i = 0; i < 8; ++i) {
+		c[i] = glm::vec3((i & 1) ? max.x : min.x, (i & 2) ? max.y : min.y, (i & 4) ? max.z : min.z);
+	}
+	//two triangles per face (winding doesn't matter; occluders are drawn double-sided):
+	static uint8_t const faces[6][4] = {
+		{0,2,6,4}, {1,5,7,3}, //-x, +x
+		{0,4,5,1}, {2,3,7,6}, //-y, +y
+		{0,1,3,2}, {4,6,7,5}, //-z, +z
+	};
+	auto triangles = std::make_shared< std::vector< glm::vec3 > >();
+	triangles->reserve(6 * 2 * 3);
+	for (auto const &f : faces) {
+		triangles->insert(triangles->end(), { c[f[0]], c[f[1]], c[f[2]] });
+		triangles->insert(triangles->end(), { c[f[0]], c[f[2]], c[f[3]] });
+	}
+
+	occluders.emplace_back();
+	occluders.back().transform = transform;
+	occluders.back().triangles = triangles;
+}
+
+void OcclusionBuffer::clear() {
+	std::fill(depth.begin(), depth.end(), std::numeric_limits< float >::infinity());
+	stats = Stats();
+}
+
+void OcclusionBuffer::rasterize(glm::mat4 const &object_to_clip, glm::vec3 const *positions, size_t count) {
+	for (size_t t = 0; t < count; ++t) {
+		//to screen space (pixel units) + NDC depth:
+		glm::vec3 v[3];
+		bool in_front = true;
+		for (uint32_t i = 0; i < 3; ++i) {
+			glm::vec4 clip = object_to_clip * glm::vec4(positions[3*t+i], 1.0f);
+			if (!(clip.w > 0.0f && clip.z >= -clip.w)) {
+				in_front = false;
+				break;
+			}
+			v[i] = glm::vec3(
+				(clip.x / clip.w * 0.5f + 0.5f) * float(width),
+				(clip.y / clip.w * 0.5f + 0.5f) * float(height),
+				clip.z / clip.w
+			);
+		}
+		if (!in_front) {
+			stats.triangles_skipped += 1;
+			continue;
+		}
+
+		glm::vec2 d1 = glm::vec2(v[1] - v[0]);
+		glm::vec2 d2 = glm::vec2(v[2] - v[0]);
+		float area = d1.x * d2.y - d2.x * d1.y;
+		if (std::abs(area) < 1e-8f) {
+			stats.triangles_skipped += 1;
+			continue;
+		}
+		if (area < 0.0f) { //make counterclockwise
+			std::swap(v[1], v[2]);
+			std::swap(d1, d2);
+			area = -area;
+		}
+
+		//pixels whose centers are in the triangle's bounding box:
+		float lo_x = std::min(v[0].x, std::min(v[1].x, v[2].x));
+		float hi_x = std::max(v[0].x, std::max(v[1].x, v[2].x));
+		float lo_y = std::min(v[0].y, std::min(v[1].y, v[2].y));
+		float hi_y = std::max(v[0].y, std::max(v[1].y, v[2].y));
+		int32_t x_min = std::max(0, int32_t(std::ceil(lo_x - 0.5f)));
+		int32_t x_max = std::min(int32_t(width) - 1, int32_t(std::floor(hi_x - 0.5f)));
+		int32_t y_min = std::max(0, int32_t(std::ceil(lo_y - 0.5f)));
+		int32_t y_max = std::min(int32_t(height) - 1, int32_t(std::floor(hi_y - 0.5f)));
+		stats.triangles_drawn += 1;
+		if (x_min > x_max || y_min > y_max) continue;
+
+		//edge functions e = a * x + b * y + c, non-negative inside:
+		float ea[3], eb[3], ec[3];
+		for (uint32_t i = 0; i < 3; ++i) {
+			glm::vec3 const &p = v[i];
+			glm::vec3 const &q = v[(i + 1) % 3];
+			ea[i] = -(q.y - p.y);
+			eb[i] = (q.x - p.x);
+			ec[i] = -(ea[i] * p.x + eb[i] * p.y);
+		}
+		//depth plane z = zx * x + zy * y + zc:
+		float zx = ((v[1].z - v[0].z) * d2.y - (v[2].z - v[0].z) * d1.y) / area;
+		float zy = ((v[2].z - v[0].z) * d1.x - (v[1].z - v[0].z) * d2.x) / area;
+		float zc = v[0].z - zx * v[0].x - zy * v[0].y;
+
+		for (int32_t y = y_min; y <= y_max; ++y) {
+			float fy = float(y) + 0.5f;
+			float *row = depth.data() + size_t(y) * width;
+			int32_t x = x_min & ~3; //(rows are a multiple of four wide, so groups never run off the end)
+
+			#if OCCLUSION_SSE2
+			if (simd) {
+				__m128 const lane = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+				__m128 const zero = _mm_setzero_ps();
+				__m128 row_e[3], step_e[3];
+				for (uint32_t i = 0; i < 3; ++i) {
+					row_e[i] = _mm_set1_ps(eb[i] * fy + ec[i]);
+					step_e[i] = _mm_set1_ps(ea[i]);
+				}
+				__m128 row_z = _mm_set1_ps(zy * fy + zc);
+				__m128 step_z = _mm_set1_ps(zx);
+				for (; x <= x_max; x += 4) {
+					__m128 fx = _mm_add_ps(_mm_set1_ps(float(x)), lane);
+					__m128 inside = _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(step_e[0], fx), row_e[0]), zero);
+					inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(step_e[1], fx), row_e[1]), zero));
+					inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(step_e[2], fx), row_e[2]), zero));
+					if (_mm_movemask_ps(inside) == 0) continue;
+					__m128 z = _mm_add_ps(_mm_mul_ps(step_z, fx), row_z);
+					__m128 stored = _mm_loadu_ps(row + x);
+					__m128 nearer = _mm_min_ps(stored, z);
+					_mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, stored)));
+				}
+				continue;
+			}
+			#endif
+
+			//(same operation order as above, so both paths produce identical depth)
+			float row_e[3];
+			for (uint32_t i = 0; i < 3; ++i) row_e[i] = eb[i] * fy + ec[i];
+			float row_z = zy * fy + zc;
+			for (; x <= x_max; ++x) {
+				float fx = float(x) + 0.5f;
+				if (ea[0] * fx + row_e[0] < 0.0f) continue;
+				if (ea[1] * fx + row_e[1] < 0.0f) continue;
+				if (ea[2] * fx + row_e[2] < 0.0f) continue;
+				row[x] = std::min(row[x], zx * fx + row_z);
+			}
+		}
+	}
+}
+
+bool OcclusionBuffer::box_visible(glm::mat4 const &world_to_clip, glm::vec3 const &min, glm::vec3 const &max) const {
+	stats.boxes_tested += 1;
+
+	//screen rectangle and nearest depth of the box:
+	glm::vec2 lo = glm::vec2( std::numeric_limits< float >::infinity());
+	glm::vec2 hi = glm::vec2(-std::numeric_limits< float >::infinity());
+	float near_z = std::numeric_limits< float >::infinity();
+	for (uint32_t i = 0; i < 8; ++i) {
+		glm::vec3 corner = glm::vec3((i & 1) ? max.x : min.x, (i & 2) ? max.y : min.y, (i & 4) ? max.z : min.z);
+		glm::vec4 clip = world_to_clip * glm::vec4(corner, 1.0f);
+		//boxes crossing the near plane are close enough to just draw:
+		if (!(clip.w > 0.0f && clip.z >= -clip.w)) return true;
+		glm::vec2 screen = (glm::vec2(clip) / clip.w * 0.5f + 0.5f) * glm::vec2(float(width), float(height));
+		lo = glm::min(lo, screen);
+		hi = glm::max(hi, screen);
+		near_z = std::min(near_z, clip.z / clip.w);
+	}
+
+	//every pixel the rectangle touches:
+	int32_t x_min = std::max(0, int32_t(std::floor(lo.x)));
+	int32_t x_max = std::min(int32_t(width) - 1, int32_t(std::floor(hi.x)));
+	int32_t y_min = std::max(0, int32_t(std::floor(lo.y)));
+	int32_t y_max = std::min(int32_t(height) - 1, int32_t(std::floor(hi.y)));
+	if (x_min > x_max || y_min > y_max) return true; //(off screen -- frustum culling's job)
+
+	for (int32_t y = y_min; y <= y_max; ++y) {
+		float const *row = depth.data() + size_t(y) * width;
+		int32_t x = x_min;
+
+		#if OCCLUSION_SSE2
+		if (simd) {
+			__m128 const box_z = _mm_set1_ps(near_z);
+			for (; x + 3 <= x_max; x += 4) {
+				//visible where nothing strictly nearer than the box was drawn:
+				if (_mm_movemask_ps(_mm_cmpge_ps(_mm_loadu_ps(row + x), box_z)) != 0) return true;
+			}
+		}
+		#endif
+
+		for (; x <= x_max; ++x) {
+			if (row[x] >= near_z) return true;
+		}
+	}
+
+	stats.boxes_occluded += 1;
+	return false;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+/*
+ * OcclusionBuffer is a small CPU depth buffer for occlusion culling.
+ *
+ * Each frame, Scene::draw (set Scene::occlusion to enable) clears it,
+ *  rasterizes the occluder meshes into it, and skips drawables whose world
+ *  bounds are entirely behind the stored depth.
+ *
+ * Depth is NDC z (z/w), which is linear in screen space for both perspective
+ *  and orthographic projections. Rows are processed four pixels at a time with
+ *  SSE2 where available (scalar code otherwise).
+ *
+ * Occluders should be simple and lie *inside* the objects they stand for
+ *  (e.g., a box inset into a building) -- anything an occluder covers is
+ *  considered hidden. Occluder triangles that cross the near plane are
+ *  skipped, which only makes culling less aggressive.
+ *
+ * Nothing here touches OpenGL, so it can be exercised headless.
+ *
+ */
+
+#include "Scene.hpp"
+
+#include <glm/glm.hpp>
+
+#include <memory>
+#include <vector>
+#include <cstdint>
+
+struct OcclusionBuffer {
+	//(width is rounded up to a multiple of four)
+	OcclusionBuffer(uint32_t width = 256, uint32_t height = 128);
+
+	//occluders drawn each frame: triangle lists (three positions per triangle) in their transform's local space:
+	struct Occluder {
+		Scene::Transform const *transform = nullptr;
+		std::shared_ptr< std::vector< glm::vec3 > const > triangles;
+	};
+	std::vector< Occluder > occluders;
+
+	//add an occluder covering the box [min,max] in transform's local space:
+	void add_box_occluder(Scene::Transform const *transform, glm::vec3 const &min, glm::vec3 const &max);
+
+	//reset depth to "nothing drawn":
+	void clear();
+
+	//rasterize 'count' triangles (3 * count positions) transformed by 'object_to_clip':
+	void rasterize(glm::mat4 const &object_to_clip, glm::vec3 const *positions, size_t count);
+
+	//conservative: returns false only if the box [min,max] (transformed by 'world_to_clip') is entirely behind drawn occluders:
+	bool box_visible(glm::mat4 const &world_to_clip, glm::vec3 const &min, glm::vec3 const &max) const;
+
+	//use SSE2 code paths (if compiled in; turn off to compare against the scalar code):
+	bool simd = true;
+
+	//counters since the last clear():
+	struct Stats {
+		uint32_t triangles_drawn = 0; //triangles rasterized
+		uint32_t triangles_skipped = 0; //triangles crossing the near plane or facing edge-on
+		uint32_t boxes_tested = 0;
+		uint32_t boxes_occluded = 0;
+	};
+	mutable Stats stats;
+
+	//-- internals ---
+	uint32_t width, height;
+	std::vector< float > depth; //width * height, row-major from the bottom row; +infinity == nothing drawn
+};
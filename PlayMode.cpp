@@ -34,23 +34,45 @@
 GLuint camera_mesh_program = 0;
 Load< MeshBuffer > camera_mesh(LoadTagDefault, []() -> MeshBuffer const * {
 	MeshBuffer const *ret = new MeshBuffer(data_path("scene-bg.pnct"));
-	camera_mesh_program = ret->make_vao_for_program(lit_color_texture_program->program);
+	//(any variant will do -- they share attribute locations -- as long as it reads normals in the buffer's format)
+	uint32_t normals = (ret->quantized ? LitColorTextureProgram::OctahedralNormals : 0);
+	camera_mesh_program = ret->make_vao_for_program(LitColorTextureProgram::variant(LitColorTextureProgram::Textured | LitColorTextureProgram::VertexColor | normals).program);
 	return ret;
 });
 
 Load< Scene > camera_scene(LoadTagDefault, []() -> Scene const * {
 	return new Scene(data_path("scene-bg.scene"), [&](Scene &scene, Scene::Transform *transform, std::string const &mesh_name){
+		if (MeshBuffer::is_lod_name(mesh_name)) return; //(drawn as a level of detail of its base mesh)
 		Mesh const &mesh = camera_mesh->lookup(mesh_name);
 
 		scene.drawables.emplace_back(transform);
 		Scene::Drawable &drawable = scene.drawables.back();
 
 		drawable.pipeline = lit_color_texture_program_pipeline;
+		//(these meshes are vertex-colored only -- no need to sample, or bind, the default white texture)
+		drawable.pipeline.features &= ~LitColorTextureProgram::Textured;
+		drawable.pipeline.textures[0] = Scene::Drawable::Pipeline::TextureInfo();
+		if (camera_mesh->quantized) drawable.pipeline.features |= LitColorTextureProgram::OctahedralNormals;
 
 		drawable.pipeline.vao = camera_mesh_program;
 		drawable.pipeline.type = mesh.type;
 		drawable.pipeline.start = mesh.start;
 		drawable.pipeline.count = mesh.count;
+		drawable.pipeline.index_type = mesh.index_type;
+		drawable.pipeline.position_offset = mesh.position_offset;
+		drawable.pipeline.position_scale = mesh.position_scale;
+
+		drawable.min = mesh.min;
+		drawable.max = mesh.max;
+
+		//"Name.LOD1", "Name.LOD2", ... take over as the drawable covers less than 1/4, 1/8, ... of the screen:
+		float screen_size = 0.25f;
+		for (Mesh const *lod : camera_mesh->lookup_lods(mesh_name)) {
+			if (drawable.lod_count == Scene::Drawable::LODCount || lod->type != mesh.type || lod->index_type != mesh.index_type) break;
+			if (lod->position_offset != mesh.position_offset || lod->position_scale != mesh.position_scale) break;
+			drawable.add_lod(lod->start, lod->count, screen_size);
+			screen_size *= 0.5f;
+		}
 
 	});
 });
@@ -322,18 +344,17 @@ void PlayMode::update(float elapsed) {
 	up.downs = 0;
 	down.downs = 0;
 
-	world_to_clip = camera->make_projection() * glm::mat4(camera->transform->make_world_to_local());
+	world_to_clip = camera->make_projection() * glm::mat4(scene.make_world_to_local(camera->transform));
 }
 
 void PlayMode::draw(glm::uvec2 const &drawable_size) {
 	//update camera aspect ratio for drawable:
 	camera->aspect = float(drawable_size.x) / float(drawable_size.y);
 
-	glUseProgram(lit_color_texture_program->program);
-	glUniform1i(lit_color_texture_program->LIGHT_TYPE_int, 1);
-	glUniform3fv(lit_color_texture_program->LIGHT_DIRECTION_vec3, 1, glm::value_ptr(glm::vec3(0.0f, 0.0f,-1.0f)));
-	glUniform3fv(lit_color_texture_program->LIGHT_ENERGY_vec3, 1, glm::value_ptr(glm::vec3(1.0f, 1.0f, 0.95f)));
-	glUseProgram(0);
+	//lighting is passed to the shaders through the scene's 'Frame' uniform block:
+	scene.frame_light.type = 1;
+	scene.frame_light.direction = glm::vec3(0.0f, 0.0f,-1.0f);
+	scene.frame_light.energy = glm::vec3(1.0f, 1.0f, 0.95f);
 
 	glClearColor(0.5f, 0.5f, 0.5f, 1.0f);
 	glClearDepth(1.0f); //1.0 is actually the default value to clear the depth buffer to, but FYI you can change it.
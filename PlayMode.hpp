@@ -1,6 +1,7 @@
 #include "Mode.hpp"
 
 #include "Scene.hpp"
+#include "SceneInstance.hpp"
 #include "Sound.hpp"
 
 #include <ft2build.h>
@@ -31,8 +32,8 @@ struct PlayMode : Mode {
 		uint8_t pressed = 0;
 	} left, right, down, up;
 
-	//local copy of the game scene (so code can change it during gameplay):
-	Scene scene;
+	//copy-on-write view of the game scene (so code can change it during gameplay):
+	SceneInstance scene;
 
 	glm::mat4 world_to_clip;
 	glm::mat4 set_to_screen;
@@ -1,11 +1,19 @@
 #include "Scene.hpp"
 
+#include "DrawableBVH.hpp"
+#include "OcclusionBuffer.hpp"
+#include "Frustum.hpp"
+#include "MappedFile.hpp"
+#include "WorkerPool.hpp"
 #include "gl_errors.hpp"
 #include "read_write_chunk.hpp"
 
 #include <glm/gtc/type_ptr.hpp>
 
-#include <fstream>
+#include <algorithm>
+#include <cstring>
+#include <istream>
+#include <streambuf>
 
 //-------------------------
 
@@ -57,17 +65,322 @@ glm::mat4x3 Scene::Transform::make_parent_to_local() const {
 }
 
 glm::mat4x3 Scene::Transform::make_local_to_world() const {
-	if (!parent) {
-		return make_local_to_parent();
-	} else {
-		return parent->make_local_to_world() * glm::mat4(make_local_to_parent()); //note: glm::mat4(glm::mat4x3) pads with a (0,0,0,1) row
-	}
+	return local_to_world();
 }
 glm::mat4x3 Scene::Transform::make_world_to_local() const {
+	return world_to_local();
+}
+
+glm::mat4x3 const &Scene::Transform::local_to_world() const {
+	update_world_cache();
+	return world_cache.local_to_world;
+}
+glm::mat4x3 const &Scene::Transform::world_to_local() const {
+	update_world_cache();
+	return world_cache.world_to_local;
+}
+
+uint32_t Scene::Transform::world_generation() const {
+	update_world_cache();
+	return world_cache.generation;
+}
+
+//were the cached matrices built from the current local values?
+static bool local_values_cached(Scene::Transform const &t) {
+	return t.world_cache.generation != 0
+	    && t.world_cache.parent == t.parent
+	    && t.world_cache.position == t.position
+	    && t.world_cache.rotation == t.rotation
+	    && t.world_cache.scale == t.scale;
+}
+
+//...and from the parent's current cached matrices?
+static bool world_cache_current(Scene::Transform const &t) {
+	return local_values_cached(t)
+	    && t.world_cache.parent_generation == (t.parent ? t.parent->world_cache.generation : 0);
+}
+
+void Scene::Transform::update_world_cache() const {
+	//find the topmost transform on the way up whose cache is out of date:
+	// (just comparisons; usually there's none, and the cached matrices are returned as-is)
+	uint32_t depth = 0;
+	uint32_t stale = -1U; //(steps up from this transform)
+	for (Transform const *t = this; t; t = t->parent, ++depth) {
+		if (!world_cache_current(*t)) stale = depth;
+	}
+	if (stale == -1U) return;
+
+	//refresh from there back down to this transform, parents first:
+	std::vector< Transform const * > chain;
+	chain.reserve(stale + 1);
+	for (Transform const *t = this; chain.size() <= stale; t = t->parent) chain.emplace_back(t);
+	for (auto t = chain.rbegin(); t != chain.rend(); ++t) {
+		(*t)->refresh_world_cache();
+	}
+}
+
+void Scene::Transform::refresh_world_cache() const {
+	uint32_t parent_generation = (parent ? parent->world_cache.generation : 0);
+
+	//nothing changed since the last update => cached matrices are still good:
+	if (world_cache.parent_generation == parent_generation && local_values_cached(*this)) return;
+
 	if (!parent) {
-		return make_parent_to_local();
+		world_cache.local_to_world = make_local_to_parent();
+		world_cache.world_to_local = make_parent_to_local();
 	} else {
-		return make_parent_to_local() * glm::mat4(parent->make_world_to_local()); //note: glm::mat4(glm::mat4x3) pads with a (0,0,0,1) row
+		world_cache.local_to_world = parent->world_cache.local_to_world * glm::mat4(make_local_to_parent()); //note: glm::mat4(glm::mat4x3) pads with a (0,0,0,1) row
+		world_cache.world_to_local = make_parent_to_local() * glm::mat4(parent->world_cache.world_to_local);
+	}
+
+	world_cache.position = position;
+	world_cache.rotation = rotation;
+	world_cache.scale = scale;
+	world_cache.parent = parent;
+	world_cache.parent_generation = parent_generation;
+
+	//bump generation so descendants notice the change (skipping 0, which means "never computed"):
+	world_cache.generation += 1;
+	if (world_cache.generation == 0) world_cache.generation = 1;
+}
+
+//-------------------------
+
+static uint32_t name_hash(std::string_view name) {
+	return uint32_t(std::hash< std::string_view >()(name));
+}
+
+void Scene::set_name(Transform *transform, std::string_view name) {
+	assert(transform);
+
+	unindex_name(transform);
+	transform->name = intern_name(name);
+	index_name(transform);
+}
+
+void Scene::index_name(Transform *transform) {
+	assert(transform);
+	name_entries.emplace_back(NameEntry{transform->name, transform});
+	insert_name_entry(uint32_t(name_entries.size() - 1));
+	name_order_dirty = true;
+}
+
+void Scene::unindex_name(Transform const *transform) {
+	assert(transform);
+	if (name_table.empty()) return;
+	uint32_t mask = uint32_t(name_table.size()) - 1;
+	for (uint32_t s = name_hash(transform->name) & mask; name_table[s] != -1U; s = (s + 1) & mask) {
+		if (name_entries[name_table[s]].transform == transform) {
+			erase_name_entry(name_table[s]);
+			return;
+		}
+	}
+}
+
+std::string_view Scene::intern_name(std::string_view name) {
+	if (name.empty()) return std::string_view();
+
+	//share the characters of an already-indexed name:
+	if (!name_table.empty()) {
+		uint32_t mask = uint32_t(name_table.size()) - 1;
+		for (uint32_t s = name_hash(name) & mask; name_table[s] != -1U; s = (s + 1) & mask) {
+			if (name_entries[name_table[s]].name == name) return name_entries[name_table[s]].name;
+		}
+	}
+
+	//otherwise, append to the current block (starting a new one when it is full, so existing views stay valid):
+	enum : size_t { NameBlockSize = 4096 };
+	if (!name_block || name_block->capacity() - name_block->size() < name.size()) {
+		name_block = std::make_shared< std::vector< char > >();
+		name_block->reserve(std::max< size_t >(NameBlockSize, name.size()));
+		name_storage.emplace_back(name_block);
+	}
+	size_t at = name_block->size();
+	name_block->insert(name_block->end(), name.begin(), name.end());
+	return std::string_view(name_block->data() + at, name.size());
+}
+
+void Scene::insert_name_entry(uint32_t entry) {
+	//keep the table at most half full:
+	if (name_table.size() < 2 * name_entries.size()) {
+		uint32_t capacity = 16;
+		while (capacity < 2 * name_entries.size()) capacity *= 2;
+		name_table.assign(capacity, -1U);
+		for (uint32_t e = 0; e < name_entries.size(); ++e) {
+			if (e != entry) insert_name_entry(e);
+		}
+	}
+	uint32_t mask = uint32_t(name_table.size()) - 1;
+	uint32_t s = name_hash(name_entries[entry].name) & mask;
+	while (name_table[s] != -1U) s = (s + 1) & mask;
+	name_table[s] = entry;
+}
+
+void Scene::erase_name_entry(uint32_t entry) {
+	assert(entry < name_entries.size() && !name_table.empty());
+	uint32_t mask = uint32_t(name_table.size()) - 1;
+	auto slot_of = [&](uint32_t e) {
+		uint32_t s = name_hash(name_entries[e].name) & mask;
+		while (name_table[s] != e) {
+			assert(name_table[s] != -1U && "entry is in the table");
+			s = (s + 1) & mask;
+		}
+		return s;
+	};
+
+	//empty the entry's slot, shifting later entries of the probe run back into the hole (so no tombstones are needed):
+	uint32_t hole = slot_of(entry);
+	for (uint32_t s = (hole + 1) & mask; name_table[s] != -1U; s = (s + 1) & mask) {
+		uint32_t home = name_hash(name_entries[name_table[s]].name) & mask;
+		//(the entry at 's' may move to 'hole' unless its home slot lies after the hole)
+		if (((s - home) & mask) >= ((s - hole) & mask)) {
+			name_table[hole] = name_table[s];
+			hole = s;
+		}
+	}
+	name_table[hole] = -1U;
+
+	//keep name_entries compact by moving the last entry into the freed index:
+	uint32_t last = uint32_t(name_entries.size()) - 1;
+	if (entry != last) {
+		name_table[slot_of(last)] = entry;
+		name_entries[entry] = name_entries[last];
+	}
+	name_entries.pop_back();
+	name_order_dirty = true;
+}
+
+Scene::Transform *Scene::find_transform(std::string_view name) const {
+	if (name_table.empty()) return nullptr;
+	uint32_t mask = uint32_t(name_table.size()) - 1;
+	for (uint32_t s = name_hash(name) & mask; name_table[s] != -1U; s = (s + 1) & mask) {
+		NameEntry const &entry = name_entries[name_table[s]];
+		if (entry.transform && entry.name == name) return entry.transform;
+	}
+	return nullptr;
+}
+
+std::vector< Scene::Transform * > Scene::find_transforms_with_prefix(std::string_view prefix) const {
+	if (name_order_dirty) {
+		name_order.resize(name_entries.size());
+		for (uint32_t e = 0; e < name_order.size(); ++e) {
+			name_order[e] = e;
+		}
+		std::sort(name_order.begin(), name_order.end(), [this](uint32_t a, uint32_t b){
+			return name_entries[a].name < name_entries[b].name;
+		});
+		name_order_dirty = false;
+	}
+
+	std::vector< Transform * > ret;
+	auto begin = std::lower_bound(name_order.begin(), name_order.end(), prefix, [this](uint32_t a, std::string_view b){
+		return name_entries[a].name < b;
+	});
+	for (auto i = begin; i != name_order.end() && name_entries[*i].name.substr(0, prefix.size()) == prefix; ++i) {
+		if (name_entries[*i].transform) ret.emplace_back(name_entries[*i].transform);
+	}
+	return ret;
+}
+
+void Scene::rebuild_name_index() {
+	name_entries.clear();
+	name_entries.reserve(transforms.size());
+	for (auto &t : transforms) {
+		name_entries.emplace_back(NameEntry{t.name, &t});
+	}
+
+	name_order.resize(name_entries.size());
+	for (uint32_t e = 0; e < name_order.size(); ++e) {
+		name_order[e] = e;
+	}
+	std::stable_sort(name_order.begin(), name_order.end(), [this](uint32_t a, uint32_t b){
+		return name_entries[a].name < name_entries[b].name;
+	});
+	name_order_dirty = false;
+
+	//(entries go in in load order, so lookups of duplicated names find the first one loaded)
+	name_table.clear();
+	for (uint32_t e = 0; e < name_entries.size(); ++e) {
+		insert_name_entry(e);
+	}
+}
+
+//-------------------------
+
+void Scene::update_world_matrices(WorkerPool *pool) const {
+	if (!pool) pool = &WorkerPool::shared();
+
+	//small scenes aren't worth the synchronization overhead -- sweep in list order instead:
+	if (transforms.size() < 2048 || pool->size() == 0) {
+		//(sweep numbers are shared by all scenes, so a parent in another scene is never mistaken for one swept here)
+		static std::atomic< uint32_t > sweeps(0);
+		uint32_t sweep = ++sweeps;
+		if (sweep == 0) sweep = ++sweeps; //(0 is what transforms start with)
+		for (auto const &t : transforms) {
+			if (!t.parent || t.parent->world_sweep == sweep) t.refresh_world_cache();
+			else t.update_world_cache(); //parent not reached yet, so its cache may be stale
+			t.world_sweep = sweep;
+		}
+		return;
+	}
+
+	//are the stored depths still right? (each must be one more than its parent's, so this is a single pass)
+	bool levels_current = true;
+	uint32_t levels = 0;
+	for (auto const &t : transforms) {
+		uint32_t expected = (t.parent ? t.parent->world_level + 1 : 0);
+		if (t.world_level != expected) {
+			levels_current = false;
+			break;
+		}
+		levels = std::max(levels, t.world_level + 1);
+	}
+
+	if (!levels_current) {
+		//re-derive depths, each computed once from its parent's:
+		// (-1U marks "not yet derived"; parents outside this scene keep the depth they have)
+		for (auto const &t : transforms) t.world_level = -1U;
+		std::vector< Transform const * > path;
+		levels = 0;
+		for (auto const &t : transforms) {
+			//walk up to the first transform with a known depth, then fill in on the way back down:
+			path.clear();
+			Transform const *at = &t;
+			while (at && at->world_level == -1U) {
+				path.emplace_back(at);
+				at = at->parent;
+			}
+			uint32_t level = (at ? at->world_level + 1 : 0);
+			for (auto p = path.rbegin(); p != path.rend(); ++p) {
+				(*p)->world_level = level;
+				levels = std::max(levels, level + 1);
+				++level;
+			}
+		}
+	}
+
+	//bucket transforms by depth (counting sort):
+	world_level_begin.assign(levels + 1, 0);
+	for (auto const &t : transforms) world_level_begin[t.world_level + 1] += 1;
+	for (uint32_t d = 1; d < world_level_begin.size(); ++d) world_level_begin[d] += world_level_begin[d-1];
+	world_by_level.resize(transforms.size());
+	{
+		std::vector< uint32_t > fill(world_level_begin.begin(), world_level_begin.end() - 1);
+		for (auto const &t : transforms) {
+			world_by_level[fill[t.world_level]++] = &t;
+		}
+	}
+
+	//every transform in a level depends only on the (already finished) level above it,
+	// so each level can be split freely across workers:
+	for (uint32_t d = 0; d + 1 < world_level_begin.size(); ++d) {
+		uint32_t begin = world_level_begin[d];
+		uint32_t end = world_level_begin[d+1];
+		pool->parallel_for(end - begin, [&](uint32_t b, uint32_t e) {
+			for (uint32_t i = begin + b; i < begin + e; ++i) {
+				world_by_level[i]->refresh_world_cache();
+			}
+		}, 512);
 	}
 }
 
@@ -87,10 +400,471 @@ void Scene::draw(Camera const &camera) const {
 	draw(world_to_clip, world_to_light);
 }
 
-void Scene::draw(glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_light) const {
+//Uniform block layouts (std140); the structs below must match these byte-for-byte:
+char const *Scene::ObjectBlockGLSL =
+	"layout(std140) uniform Object {\n"
+	"	mat4 OBJECT_TO_CLIP;\n"
+	"	mat4x3 OBJECT_TO_LIGHT;\n"
+	"	mat3 NORMAL_TO_LIGHT;\n"
+	"	int LIGHT_COUNT;\n" //entries of LIGHT_INDICES in use
+	"	ivec4 LIGHT_INDICES[2];\n" //indices into LIGHTS (Scene::MaxObjectLights of them)
+	"};\n";
+
+char const *Scene::FrameBlockGLSL =
+	"layout(std140) uniform Frame {\n"
+	"	mat4 WORLD_TO_CLIP;\n"
+	"	mat4x3 WORLD_TO_LIGHT;\n"
+	"	int LIGHT_TYPE;\n"
+	"	vec3 LIGHT_LOCATION;\n"
+	"	float LIGHT_CUTOFF;\n"
+	"	vec3 LIGHT_DIRECTION;\n"
+	"	vec3 LIGHT_ENERGY;\n"
+	"	int GLOBAL_LIGHT_COUNT;\n" //LIGHTS[0 .. GLOBAL_LIGHT_COUNT-1] reach every drawable (they're not in the per-object lists)
+	"};\n";
+
+char const *Scene::LightsBlockGLSL =
+	"struct SceneLight {\n"
+	"	vec4 LOCATION_TYPE;\n" //xyz: location (light space), w: type (0: point; 1: hemisphere; 2: spot; 3: directional)
+	"	vec4 DIRECTION_CUTOFF;\n" //xyz: direction (light space), w: cosine of spot half-angle
+	"	vec4 ENERGY_RANGE;\n" //rgb: energy, w: distance at which the light fades out (0 => no limit)
+	"};\n"
+	"layout(std140) uniform Lights {\n"
+	"	SceneLight LIGHTS[256];\n" //(Scene::MaxFrameLights)
+	"};\n";
+
+//(std140 pads every matrix column and every vec3 out to 16 bytes)
+struct ObjectBlock {
+	glm::mat4 object_to_clip; //offset 0
+	glm::vec4 object_to_light[4]; //offset 64
+	glm::vec4 normal_to_light[3]; //offset 128
+	int32_t light_count; //offset 176
+	int32_t padding0[3];
+	int32_t light_indices[Scene::MaxObjectLights]; //offset 192
+};
+static_assert(sizeof(ObjectBlock) == 224, "ObjectBlock matches std140 layout");
+
+struct FrameBlock {
+	glm::mat4 world_to_clip; //offset 0
+	glm::vec4 world_to_light[4]; //offset 64
+	int32_t light_type; //offset 128
+	float padding0[3];
+	glm::vec3 light_location; //offset 144
+	float light_cutoff; //offset 156
+	glm::vec3 light_direction; //offset 160
+	float padding1;
+	glm::vec3 light_energy; //offset 176
+	int32_t global_light_count; //offset 188
+};
+static_assert(sizeof(FrameBlock) == 192, "FrameBlock matches std140 layout");
+
+struct LightsBlockEntry {
+	glm::vec4 location_type;
+	glm::vec4 direction_cutoff;
+	glm::vec4 energy_range;
+};
+static_assert(sizeof(LightsBlockEntry) == 48, "LightsBlockEntry matches std140 layout");
+
+void Scene::bind_uniform_blocks(GLuint program) {
+	GLuint object_index = glGetUniformBlockIndex(program, "Object");
+	if (object_index != GL_INVALID_INDEX) glUniformBlockBinding(program, object_index, ObjectBlockBinding);
+	GLuint frame_index = glGetUniformBlockIndex(program, "Frame");
+	if (frame_index != GL_INVALID_INDEX) glUniformBlockBinding(program, frame_index, FrameBlockBinding);
+	GLuint lights_index = glGetUniformBlockIndex(program, "Lights");
+	if (lights_index != GL_INVALID_INDEX) glUniformBlockBinding(program, lights_index, LightsBlockBinding);
+}
+
+//-------------------------
+
+static void add_uniform(Scene::Drawable::Pipeline *pipeline, GLuint location, Scene::Drawable::Pipeline::Uniform::Type type, void const *value, size_t size) {
+	if (pipeline->uniform_count >= Scene::Drawable::Pipeline::UniformCount) {
+		throw std::runtime_error("Pipeline already has " + std::to_string(pipeline->uniform_count) + " uniforms; can't add another.");
+	}
+	Scene::Drawable::Pipeline::Uniform &uniform = pipeline->uniforms[pipeline->uniform_count++];
+	uniform.location = location;
+	uniform.type = type;
+	std::memset(&uniform.value, 0, sizeof(uniform.value));
+	std::memcpy(&uniform.value, value, size);
+}
+
+void Scene::Drawable::Pipeline::add_uniform(GLuint location, int32_t value) {
+	::add_uniform(this, location, Uniform::Int, &value, sizeof(value));
+}
+void Scene::Drawable::Pipeline::add_uniform(GLuint location, float value) {
+	::add_uniform(this, location, Uniform::Float, &value, sizeof(value));
+}
+void Scene::Drawable::Pipeline::add_uniform(GLuint location, glm::vec2 const &value) {
+	::add_uniform(this, location, Uniform::Vec2, glm::value_ptr(value), sizeof(float) * 2);
+}
+void Scene::Drawable::Pipeline::add_uniform(GLuint location, glm::vec3 const &value) {
+	::add_uniform(this, location, Uniform::Vec3, glm::value_ptr(value), sizeof(float) * 3);
+}
+void Scene::Drawable::Pipeline::add_uniform(GLuint location, glm::vec4 const &value) {
+	::add_uniform(this, location, Uniform::Vec4, glm::value_ptr(value), sizeof(float) * 4);
+}
+
+void Scene::Drawable::add_lod(GLuint start, GLuint count, float screen_size) {
+	if (lod_count >= LODCount) {
+		throw std::runtime_error("Drawable already has " + std::to_string(lod_count) + " levels of detail; can't add another.");
+	}
+	LOD &level = lods[lod_count++];
+	level.start = start;
+	level.count = count;
+	level.screen_size = screen_size;
+}
+
+//Pick a drawable's level of detail for a projected size, starting from the level it used last time ('previous'):
+// (levels only change once the size is 'hysteresis' past a threshold, so hovering near one doesn't flicker)
+static uint32_t select_lod(Scene::Drawable const &drawable, uint32_t previous, float screen_size, float hysteresis) {
+	uint32_t level = std::min(previous, drawable.lod_count);
+	//finer while clearly larger than the current level's threshold:
+	while (level > 0 && screen_size > drawable.lods[level-1].screen_size * (1.0f + hysteresis)) --level;
+	//coarser while clearly smaller than the next level's threshold:
+	while (level < drawable.lod_count && screen_size < drawable.lods[level].screen_size * (1.0f - hysteresis)) ++level;
+	return level;
+}
+
+//send a pipeline's extra uniforms to the currently bound program:
+static void apply_uniforms(Scene::Drawable::Pipeline const &pipeline) {
+	for (uint32_t u = 0; u < pipeline.uniform_count; ++u) {
+		Scene::Drawable::Pipeline::Uniform const &uniform = pipeline.uniforms[u];
+		switch (uniform.type) {
+			case Scene::Drawable::Pipeline::Uniform::Int: glUniform1iv(uniform.location, 1, uniform.value.i); break;
+			case Scene::Drawable::Pipeline::Uniform::Float: glUniform1fv(uniform.location, 1, uniform.value.f); break;
+			case Scene::Drawable::Pipeline::Uniform::Vec2: glUniform2fv(uniform.location, 1, uniform.value.f); break;
+			case Scene::Drawable::Pipeline::Uniform::Vec3: glUniform3fv(uniform.location, 1, uniform.value.f); break;
+			case Scene::Drawable::Pipeline::Uniform::Vec4: glUniform4fv(uniform.location, 1, uniform.value.f); break;
+		}
+	}
+}
+
+//Render queue entries, sorted by key before submission:
+struct QueueEntry {
+	uint64_t key;
+	Scene::Drawable const *drawable;
+	GLuint program, instanced_program; //programs to draw with (after variant selection)
+	GLuint start, count; //vertex range to draw (depends on the selected level of detail)
+	uint32_t visible; //index of the drawable in the visible list (and of its light list)
+};
+
+//Lights reaching a drawable, most important kept:
+struct ObjectLights {
+	uint32_t count = 0;
+	int32_t index[Scene::MaxObjectLights];
+	float importance[Scene::MaxObjectLights];
+
+	//add light 'l' (if there is room, or it's more important than the least important one so far); returns false if a light was dropped:
+	bool add(int32_t l, float weight) {
+		if (count < Scene::MaxObjectLights) {
+			index[count] = l;
+			importance[count] = weight;
+			++count;
+			return true;
+		}
+		uint32_t least = 0;
+		for (uint32_t i = 1; i < count; ++i) {
+			if (importance[i] < importance[least]) least = i;
+		}
+		if (importance[least] < weight) {
+			index[least] = l;
+			importance[least] = weight;
+		}
+		return false;
+	}
+};
+
+//Pack pipeline state and depth into a sort key:
+// [63..52] program | [51..40] vao | [39..28] textures | [27..16] mesh start | [15..0] depth
+// (ids are truncated, so unrelated states may collide -- that only costs some extra state changes)
+// (mesh start is included so copies of the same mesh end up adjacent and can be instanced)
+static uint64_t make_sort_key(Scene::Drawable::Pipeline const &pipeline, GLuint program, GLuint start, float depth) {
+	uint32_t textures = 0;
+	for (uint32_t i = 0; i < Scene::Drawable::Pipeline::TextureCount; ++i) {
+		textures = textures * 31 + pipeline.textures[i].texture;
+	}
+	textures ^= (textures >> 12) ^ (textures >> 24);
+
+	//for non-negative floats, the bit pattern increases with the value:
+	static_assert(sizeof(float) == sizeof(uint32_t), "float is 32 bits");
+	uint32_t depth_bits;
+	std::memcpy(&depth_bits, &depth, sizeof(depth_bits));
+
+	return (uint64_t(program & 0xfff) << 52)
+	     | (uint64_t(pipeline.vao & 0xfff) << 40)
+	     | (uint64_t(textures & 0xfff) << 28)
+	     | (uint64_t(start & 0xfff) << 16)
+	     | uint64_t(depth_bits >> 16);
+}
+
+//bytes per element of an element buffer:
+static GLsizeiptr index_size(GLenum index_type) {
+	if (index_type == GL_UNSIGNED_BYTE) return 1;
+	if (index_type == GL_UNSIGNED_SHORT) return 2;
+	assert(index_type == GL_UNSIGNED_INT);
+	return 4;
+}
+
+//Can 'eb' be drawn in the same instanced batch as 'ea'?
+static bool same_batch(QueueEntry const &ea, QueueEntry const &eb) {
+	Scene::Drawable::Pipeline const &a = ea.drawable->pipeline;
+	Scene::Drawable::Pipeline const &b = eb.drawable->pipeline;
+	if (ea.program != eb.program || ea.instanced_program != eb.instanced_program) return false;
+	if (a.vao != b.vao || a.type != b.type || a.index_type != b.index_type || ea.start != eb.start || ea.count != eb.count) return false;
+	if (b.uniform_count != 0) return false;
+	for (uint32_t i = 0; i < Scene::Drawable::Pipeline::TextureCount; ++i) {
+		if (a.textures[i].texture != b.textures[i].texture || a.textures[i].target != b.textures[i].target) return false;
+	}
+	return true;
+}
+
+//LSD radix sort by key, eight bits at a time (skipping bytes where every key agrees):
+static void radix_sort(std::vector< QueueEntry > *queue_, std::vector< QueueEntry > *temp_) {
+	auto &queue = *queue_;
+	auto &temp = *temp_;
+	if (queue.size() < 2) return;
+	temp.resize(queue.size());
+
+	for (uint32_t shift = 0; shift < 64; shift += 8) {
+		uint32_t counts[256] = { 0 };
+		for (auto const &e : queue) counts[(e.key >> shift) & 0xff] += 1;
+		if (counts[(queue[0].key >> shift) & 0xff] == queue.size()) continue; //all the same
+		uint32_t offsets[256];
+		uint32_t total = 0;
+		for (uint32_t b = 0; b < 256; ++b) {
+			offsets[b] = total;
+			total += counts[b];
+		}
+		for (auto const &e : queue) temp[offsets[(e.key >> shift) & 0xff]++] = e;
+		queue.swap(temp);
+	}
+}
+
+void Scene::draw(glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_light, DrawOverrides const *overrides) const {
+	//with overrides, all per-call state lives in the overrides (see DrawOverrides):
+	DrawStats &stats = (overrides && overrides->stats ? *overrides->stats : draw_stats);
+	stats = DrawStats();
+	OcclusionBuffer *occluder = (overrides ? overrides->occlusion : occlusion.get());
+	std::vector< uint32_t > *lods = (overrides ? overrides->lods : nullptr);
+	if (lods) lods->resize(drawables.size(), 0);
+	FrameLight const &light = (overrides && overrides->frame_light ? *overrides->frame_light : frame_light);
+
+	//world matrix of a transform:
+	// (with overrides, the override or else the cached matrix as it stands -- the cache isn't refreshed)
+	auto world_of = [overrides](Transform const *t) -> glm::mat4x3 const & {
+		assert(t);
+		if (!overrides) return t->local_to_world();
+		if (overrides->transform_world) {
+			auto f = overrides->transform_world->find(t);
+			if (f != overrides->transform_world->end()) return f->second;
+		}
+		return t->world_cache.local_to_world;
+	};
+
+	//gather the drawables that need to be sent to OpenGL:
+	std::vector< Drawable const * > visible;
+	std::vector< glm::mat4x3 const * > visible_world; //(their local_to_world matrices)
+	std::vector< uint32_t > visible_index; //(their positions in 'drawables', if drawing with overrides)
+
+	if (frustum_culling && bvh && !overrides) {
+		//hierarchical culling:
+		bvh->update(*this);
+		stats.tested = bvh->query_frustum(Frustum(world_to_clip), &visible);
+		stats.culled = stats.tested - uint32_t(visible.size() - bvh->unbounded.size());
+		visible_world.reserve(visible.size());
+		for (auto drawable_ptr : visible) {
+			visible_world.emplace_back(&drawable_ptr->transform->local_to_world());
+		}
+	} else {
+		//linear culling:
+		Frustum frustum(world_to_clip);
+		visible.reserve(drawables.size());
+		visible_world.reserve(drawables.size());
+		if (overrides) visible_index.reserve(drawables.size());
+		uint32_t index = 0;
+		for (auto const &drawable : drawables) {
+			assert(drawable.transform); //drawables *must* have a transform
+			glm::mat4x3 const *world = (overrides && overrides->world ? (*overrides->world)[index] : &world_of(drawable.transform));
+			++index;
+			//skip any drawables that are entirely outside the view frustum:
+			if (frustum_culling && drawable.has_bounds()) {
+				stats.tested += 1;
+				glm::vec3 world_min, world_max;
+				transform_box(*world, drawable.min, drawable.max, &world_min, &world_max);
+				if (!frustum.intersects_box(world_min, world_max)) {
+					stats.culled += 1;
+					continue;
+				}
+			}
+			visible.emplace_back(&drawable);
+			visible_world.emplace_back(world);
+			if (overrides) visible_index.emplace_back(index - 1);
+		}
+	}
+
+	//occlusion culling:
+	if (occluder) {
+		occluder->clear();
+		for (auto const &o : occluder->occluders) {
+			if (!o.triangles) continue;
+			assert(o.transform);
+			glm::mat4 object_to_clip = world_to_clip * glm::mat4(world_of(o.transform));
+			occluder->rasterize(object_to_clip, o.triangles->data(), o.triangles->size() / 3);
+		}
+
+		uint32_t out = 0;
+		for (uint32_t v = 0; v < visible.size(); ++v) {
+			Drawable const &drawable = *visible[v];
+			if (drawable.has_bounds()) {
+				glm::vec3 world_min, world_max;
+				transform_box(*visible_world[v], drawable.min, drawable.max, &world_min, &world_max);
+				if (!occluder->box_visible(world_to_clip, world_min, world_max)) {
+					stats.occluded += 1;
+					continue;
+				}
+			}
+			visible[out] = visible[v];
+			visible_world[out] = visible_world[v];
+			if (!visible_index.empty()) visible_index[out] = visible_index[v];
+			++out;
+		}
+		visible.resize(out);
+		visible_world.resize(out);
+		if (!visible_index.empty()) visible_index.resize(out);
+	}
+
+	//light lists:
+	// 'lights_data' holds the hemisphere and directional lights first (these reach everything, so every drawable
+	// gets them without spending list slots), then the point and spot lights that the per-drawable lists index
+	std::vector< LightsBlockEntry > lights_data;
+	uint32_t global_lights = 0;
+	std::vector< ObjectLights > object_lights(visible.size());
+	if (light_lists && !lights.empty()) {
+		//point and spot lights that could affect something in view:
+		struct LocalLight {
+			glm::vec3 location;
+			float range;
+			float strength; //largest energy component
+			glm::vec3 direction; //(spot lights)
+			float cos_half, sin_half; //(spot lights with a cone narrower than a hemisphere; otherwise sin_half < 0)
+		};
+		std::vector< LightsBlockEntry > local_data;
+		std::vector< LocalLight > local;
+		Frustum frustum(world_to_clip);
+		for (auto const &scene_light : lights) {
+			assert(scene_light.transform);
+			glm::mat4x3 const &light_to_world = world_of(scene_light.transform);
+			glm::vec3 location = light_to_world[3];
+			glm::vec3 direction = -glm::normalize(light_to_world[2]); //(lights point along -z)
+			float energy = std::max(scene_light.energy.x, std::max(scene_light.energy.y, scene_light.energy.z));
+
+			int32_t type;
+			float range = 0.0f;
+			if (scene_light.type == Light::Hemisphere) type = 1;
+			else if (scene_light.type == Light::Directional) type = 3;
+			else {
+				type = (scene_light.type == Light::Spot ? 2 : 0);
+				range = (scene_light.distance > 0.0f ? scene_light.distance : std::sqrt(std::max(0.0f, energy) / light_threshold));
+				if (!(range > 0.0f)) continue;
+				if (!frustum.intersects_box(location - glm::vec3(range), location + glm::vec3(range))) continue;
+			}
+			if (lights_data.size() + local_data.size() == MaxFrameLights) {
+				stats.lights_dropped += 1;
+				continue;
+			}
+
+			LightsBlockEntry entry;
+			entry.location_type = glm::vec4(world_to_light * glm::vec4(location, 1.0f), float(type));
+			entry.direction_cutoff = glm::vec4(glm::normalize(glm::mat3(world_to_light) * direction), std::cos(0.5f * scene_light.spot_fov));
+			entry.energy_range = glm::vec4(scene_light.energy, range);
+			if (type == 1 || type == 3) {
+				lights_data.emplace_back(entry);
+				continue;
+			}
+			local_data.emplace_back(entry);
+			LocalLight info;
+			info.location = location;
+			info.range = range;
+			info.strength = energy;
+			info.direction = direction;
+			float half = 0.5f * scene_light.spot_fov;
+			if (type == 2 && half < 0.5f * 3.14159265f) {
+				info.cos_half = std::cos(half);
+				info.sin_half = std::sin(half);
+			} else {
+				info.cos_half = 1.0f;
+				info.sin_half = -1.0f;
+			}
+			local.emplace_back(info);
+		}
+		global_lights = uint32_t(lights_data.size());
+		lights_data.insert(lights_data.end(), local_data.begin(), local_data.end());
+		stats.lights_in_view = uint32_t(lights_data.size());
+
+		//which point and spot lights reach each drawable's bounds:
+		// (weighted by energy falloff at the nearest point, so the ones that matter most are kept)
+		for (uint32_t v = 0; v < visible.size(); ++v) {
+			Drawable const &drawable = *visible[v];
+			glm::vec3 world_min, world_max;
+			if (drawable.has_bounds()) {
+				transform_box(*visible_world[v], drawable.min, drawable.max, &world_min, &world_max);
+			} else {
+				world_min = world_max = (*visible_world[v])[3];
+			}
+			//bounding sphere, for the spot cone test:
+			glm::vec3 sphere_center = 0.5f * (world_min + world_max);
+			float sphere_radius = 0.5f * glm::length(world_max - world_min);
+
+			ObjectLights &list = object_lights[v];
+			for (uint32_t l = 0; l < local.size(); ++l) {
+				LocalLight const &info = local[l];
+				glm::vec3 to_box = glm::clamp(info.location, world_min, world_max) - info.location;
+				float dis2 = glm::dot(to_box, to_box);
+				if (dis2 > info.range * info.range) continue;
+				if (info.sin_half >= 0.0f) {
+					//sphere vs. cone: skip if the sphere is behind the apex or farther than its radius from the cone's surface
+					glm::vec3 to_center = sphere_center - info.location;
+					float along = glm::dot(to_center, info.direction);
+					float across = std::sqrt(std::max(0.0f, glm::dot(to_center, to_center) - along * along));
+					if (along < -sphere_radius) continue;
+					if (info.cos_half * across - info.sin_half * along > sphere_radius) continue;
+				}
+				float weight = info.strength / std::max(1.0f, dis2);
+				if (!list.add(int32_t(global_lights + l), weight)) stats.lights_dropped += 1;
+			}
+			stats.light_assignments += list.count;
+		}
+	}
+
+	//build the render queue:
+	// sort key is (program, vao, textures, depth) from most to least significant,
+	// so drawables sharing state end up adjacent and are otherwise drawn front-to-back
+	std::vector< QueueEntry > queue;
+	queue.reserve(visible.size());
+	glm::vec4 depth_row = glm::vec4(world_to_clip[0][3], world_to_clip[1][3], world_to_clip[2][3], world_to_clip[3][3]); //clip.w == view depth
+	//clip.y per world unit across the view (a sphere of radius r at depth w covers r * y_scale / w of the viewport height):
+	float y_scale = glm::length(glm::vec3(world_to_clip[0][1], world_to_clip[1][1], world_to_clip[2][1]));
+	//program variants for the frame light's type (remembering the last lookup, since neighbors usually share it):
+	struct {
+		GLuint (*select_program)(uint32_t, int32_t, bool) = nullptr;
+		uint32_t features = 0;
+		GLuint base = 0, base_instanced = 0;
+		GLuint program = 0, instanced_program = 0;
+	} last_variant;
+	auto select_variants = [&](Drawable::Pipeline const &pipeline, GLuint *program, GLuint *instanced_program) {
+		if (!(pipeline.select_program == last_variant.select_program && pipeline.features == last_variant.features
+		 && pipeline.program == last_variant.base && pipeline.instanced_program == last_variant.base_instanced)) {
+			last_variant.select_program = pipeline.select_program;
+			last_variant.features = pipeline.features;
+			last_variant.base = pipeline.program;
+			last_variant.base_instanced = pipeline.instanced_program;
+			last_variant.program = pipeline.select_program(pipeline.features, light.type, false);
+			last_variant.instanced_program = (pipeline.instanced_program != 0 ? pipeline.select_program(pipeline.features, light.type, true) : 0);
+		}
+		*program = last_variant.program;
+		*instanced_program = last_variant.instanced_program;
+	};
+	for (uint32_t v = 0; v < visible.size(); ++v) {
+		Drawable const &drawable = *visible[v];
 
-	//Iterate through all drawables, sending each one to OpenGL:
-	for (auto const &drawable : drawables) {
 		//Reference to drawable's pipeline for convenience:
 		Scene::Drawable::Pipeline const &pipeline = drawable.pipeline;
 
@@ -101,64 +875,346 @@ void Scene::draw(glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_lig
 		//skip any drawables that don't contain any vertices:
 		if (pipeline.count == 0) continue;
 
+		glm::vec3 position = (*visible_world[v])[3];
+		float depth = std::max(0.0f, glm::dot(depth_row, glm::vec4(position, 1.0f)));
+
+		GLuint start = pipeline.start;
+		GLuint count = pipeline.count;
+		if (lod_selection && drawable.lod_count != 0 && drawable.has_bounds()) {
+			glm::vec3 world_min, world_max;
+			transform_box(*visible_world[v], drawable.min, drawable.max, &world_min, &world_max);
+			float radius = 0.5f * glm::length(world_max - world_min);
+			float center_depth = glm::dot(depth_row, glm::vec4(0.5f * (world_min + world_max), 1.0f));
+			//(inside or very near the bounds counts as huge)
+			float screen_size = (center_depth > radius ? radius * y_scale / center_depth : std::numeric_limits< float >::infinity());
+
+			uint32_t &previous = (lods ? (*lods)[visible_index[v]] : drawable.lod);
+			uint32_t level = select_lod(drawable, previous, screen_size, lod_hysteresis);
+			if (level != previous) {
+				previous = level;
+				stats.lod_switches += 1;
+			}
+			if (level > 0) {
+				start = drawable.lods[level-1].start;
+				count = drawable.lods[level-1].count;
+				stats.lod_reduced += 1;
+				if (count == 0) continue;
+			}
+		}
 
-		//Set shader program:
-		glUseProgram(pipeline.program);
+		GLuint program = pipeline.program;
+		GLuint instanced_program = pipeline.instanced_program;
+		if (pipeline.select_program) {
+			select_variants(pipeline, &program, &instanced_program);
+		}
 
-		//Set attribute sources:
-		glBindVertexArray(pipeline.vao);
+		queue.emplace_back();
+		queue.back().key = make_sort_key(pipeline, program, start, depth);
+		queue.back().drawable = &drawable;
+		queue.back().program = program;
+		queue.back().instanced_program = instanced_program;
+		queue.back().start = start;
+		queue.back().count = count;
+		queue.back().visible = v;
+	}
+
+	std::vector< QueueEntry > temp;
+	radix_sort(&queue, &temp);
+
+	//per-instance data is streamed through a buffer texture (shared by all scenes):
+	// each instance is 14 RGBA32F texels: OBJECT_TO_CLIP (4 columns), OBJECT_TO_LIGHT (4 columns, .xyz), NORMAL_TO_LIGHT (3 columns, .xyz),
+	// then the light list: (count, index 0, 1, 2), (index 3, 4, 5, 6), (index 7, -, -, -)
+	enum : uint32_t { InstanceTexels = 14 };
+	static_assert(MaxObjectLights == 8, "instance light list layout holds eight lights");
+	static GLuint instance_buffer = 0;
+	static GLuint instance_texture = 0;
+	static uint32_t max_instances = 0;
+
+	//uniform block buffers (shared by all scenes):
+	static GLuint frame_buffer = 0;
+	static GLuint object_buffer = 0;
+	static GLsizeiptr object_buffer_size = 0;
+	static uint32_t object_stride = 0; //sizeof(ObjectBlock) rounded up to GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+	static GLuint lights_buffer = 0;
+
+	//compute the per-object matrices:
+	auto object_matrices = [&](QueueEntry const &entry, glm::mat4 *object_to_clip, glm::mat4x3 *object_to_light, glm::mat3 *normal_to_light) {
+		glm::mat4x3 const &object_to_world = *visible_world[entry.visible];
+		//OBJECT_TO_CLIP takes vertices from object space to clip space:
+		*object_to_clip = world_to_clip * glm::mat4(object_to_world);
+		//OBJECT_TO_LIGHT takes vertices from object space to light space:
+		*object_to_light = world_to_light * glm::mat4(object_to_world);
+		//NORMAL_TO_LIGHT takes normals from object space to light space:
+		*normal_to_light = glm::inverse(glm::transpose(glm::mat3(*object_to_light)));
+
+		//quantized positions are scaled back into object space first:
+		Drawable::Pipeline const &pipeline = entry.drawable->pipeline;
+		if (pipeline.position_offset != glm::vec3(0.0f) || pipeline.position_scale != glm::vec3(1.0f)) {
+			glm::mat4 dequantize = glm::mat4(
+				glm::vec4(pipeline.position_scale.x, 0.0f, 0.0f, 0.0f),
+				glm::vec4(0.0f, pipeline.position_scale.y, 0.0f, 0.0f),
+				glm::vec4(0.0f, 0.0f, pipeline.position_scale.z, 0.0f),
+				glm::vec4(pipeline.position_offset, 1.0f)
+			);
+			*object_to_clip = *object_to_clip * dequantize;
+			*object_to_light = *object_to_light * dequantize;
+		}
+	};
 
-		//Configure program uniforms:
+	//split the queue into batches -- single drawables or runs of identical drawables to instance:
+	struct Batch {
+		uint32_t begin, end; //range of queue entries
+		uint32_t object_offset; //(single drawables using the 'Object' block) offset of its block in the object buffer
+	};
+	std::vector< Batch > batches;
+	batches.reserve(queue.size());
+
+	//'Object' blocks for all non-instanced drawables, written once and uploaded together:
+	std::vector< uint8_t > object_data;
+
+	for (uint32_t q = 0; q < queue.size(); /* later */) {
+		Scene::Drawable::Pipeline const &pipeline = queue[q].drawable->pipeline;
+
+		//find the run of following drawables that can share an instanced draw with this one:
+		uint32_t run_end = q + 1;
+		if (instancing && pipeline.instanced_program != 0 && pipeline.uniform_count == 0) {
+			if (max_instances == 0) {
+				GLint max_texels = 0;
+				glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &max_texels);
+				max_instances = std::max(1U, uint32_t(max_texels) / InstanceTexels);
+			}
+			while (run_end < queue.size() && run_end - q < max_instances && same_batch(queue[q], queue[run_end])) {
+				++run_end;
+			}
+		}
 
-		//the object-to-world matrix is used in all three of these uniforms:
-		assert(drawable.transform); //drawables *must* have a transform
-		glm::mat4x3 object_to_world = drawable.transform->make_local_to_world();
+		batches.emplace_back();
+		Batch &batch = batches.back();
+		batch.begin = q;
+		batch.end = run_end;
+		batch.object_offset = 0;
+
+		if (run_end - q == 1 && pipeline.object_block) {
+			if (object_stride == 0) {
+				GLint alignment = 0;
+				glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+				alignment = std::max(alignment, 1);
+				object_stride = uint32_t((sizeof(ObjectBlock) + alignment - 1) / alignment * alignment);
+			}
 
-		//OBJECT_TO_CLIP takes vertices from object space to clip space:
-		if (pipeline.OBJECT_TO_CLIP_mat4 != -1U) {
-			glm::mat4 object_to_clip = world_to_clip * glm::mat4(object_to_world);
-			glUniformMatrix4fv(pipeline.OBJECT_TO_CLIP_mat4, 1, GL_FALSE, glm::value_ptr(object_to_clip));
+			glm::mat4 object_to_clip;
+			glm::mat4x3 object_to_light;
+			glm::mat3 normal_to_light;
+			object_matrices(queue[q], &object_to_clip, &object_to_light, &normal_to_light);
+
+			ObjectBlock block = ObjectBlock(); //(value-initialized, so padding and unused light slots are zeroed)
+			block.object_to_clip = object_to_clip;
+			for (uint32_t c = 0; c < 4; ++c) block.object_to_light[c] = glm::vec4(object_to_light[c], 0.0f);
+			for (uint32_t c = 0; c < 3; ++c) block.normal_to_light[c] = glm::vec4(normal_to_light[c], 0.0f);
+			ObjectLights const &list = object_lights[queue[q].visible];
+			block.light_count = int32_t(list.count);
+			for (uint32_t i = 0; i < list.count; ++i) block.light_indices[i] = list.index[i];
+
+			batch.object_offset = uint32_t(object_data.size());
+			object_data.resize(object_data.size() + object_stride);
+			std::memcpy(object_data.data() + batch.object_offset, &block, sizeof(block));
+			stats.object_blocks += 1;
 		}
 
-		//the object-to-light matrix is used in the next two uniforms:
-		glm::mat4x3 object_to_light = world_to_light * glm::mat4(object_to_world);
+		q = run_end;
+	}
+
+	//upload uniform blocks:
+	{
+		FrameBlock block = FrameBlock(); //(value-initialized, so padding is zeroed)
+		block.world_to_clip = world_to_clip;
+		for (uint32_t c = 0; c < 4; ++c) block.world_to_light[c] = glm::vec4(world_to_light[c], 0.0f);
+		block.light_type = light.type;
+		block.light_location = light.location;
+		block.light_cutoff = light.cutoff;
+		block.light_direction = light.direction;
+		block.light_energy = light.energy;
+		block.global_light_count = int32_t(global_lights);
+
+		if (frame_buffer == 0) glGenBuffers(1, &frame_buffer);
+		glBindBuffer(GL_UNIFORM_BUFFER, frame_buffer);
+		glBufferData(GL_UNIFORM_BUFFER, sizeof(block), &block, GL_STREAM_DRAW);
+		glBindBufferBase(GL_UNIFORM_BUFFER, FrameBlockBinding, frame_buffer);
+	}
+	{
+		//(always bound at full size, since programs declare the whole array)
+		if (lights_buffer == 0) glGenBuffers(1, &lights_buffer);
+		glBindBuffer(GL_UNIFORM_BUFFER, lights_buffer);
+		glBufferData(GL_UNIFORM_BUFFER, MaxFrameLights * sizeof(LightsBlockEntry), nullptr, GL_STREAM_DRAW);
+		if (!lights_data.empty()) {
+			glBufferSubData(GL_UNIFORM_BUFFER, 0, lights_data.size() * sizeof(LightsBlockEntry), lights_data.data());
+		}
+		glBindBufferBase(GL_UNIFORM_BUFFER, LightsBlockBinding, lights_buffer);
+	}
+	if (!object_data.empty()) {
+		if (object_buffer == 0) glGenBuffers(1, &object_buffer);
+		glBindBuffer(GL_UNIFORM_BUFFER, object_buffer);
+		//re-specifying the whole store each call lets the driver hand back fresh memory
+		// instead of waiting on draws still reading last frame's blocks:
+		object_buffer_size = std::max(object_buffer_size, GLsizeiptr(object_data.size()));
+		glBufferData(GL_UNIFORM_BUFFER, object_buffer_size, nullptr, GL_STREAM_DRAW);
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, object_data.size(), object_data.data());
+	}
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+	//state currently bound (only changed when a drawable needs something different):
+	GLuint current_program = 0;
+	GLuint current_vao = 0;
+	Drawable::Pipeline::TextureInfo bound[Drawable::Pipeline::TextureCount];
+	for (auto &b : bound) b.texture = 0;
 
-		//OBJECT_TO_CLIP takes vertices from object space to light space:
-		if (pipeline.OBJECT_TO_LIGHT_mat4x3 != -1U) {
-			glUniformMatrix4x3fv(pipeline.OBJECT_TO_LIGHT_mat4x3, 1, GL_FALSE, glm::value_ptr(object_to_light));
+	std::vector< glm::vec4 > instance_data;
+	bool instance_texture_bound = false;
+
+	//Iterate through the batches, sending each drawable (or run of identical drawables) to OpenGL:
+	for (auto const &batch : batches) {
+		Drawable const &drawable = *queue[batch.begin].drawable;
+		Scene::Drawable::Pipeline const &pipeline = drawable.pipeline;
+		GLuint start = queue[batch.begin].start;
+		GLuint count = queue[batch.begin].count;
+
+		uint32_t run = batch.end - batch.begin;
+		GLuint program = (run > 1 ? queue[batch.begin].instanced_program : queue[batch.begin].program);
+
+		stats.drawn += run;
+
+		//Set shader program:
+		if (program != current_program) {
+			glUseProgram(program);
+			current_program = program;
+			stats.program_changes += 1;
 		}
 
-		//NORMAL_TO_CLIP takes normals from object space to light space:
-		if (pipeline.NORMAL_TO_LIGHT_mat3 != -1U) {
-			glm::mat3 normal_to_light = glm::inverse(glm::transpose(glm::mat3(object_to_light)));
-			glUniformMatrix3fv(pipeline.NORMAL_TO_LIGHT_mat3, 1, GL_FALSE, glm::value_ptr(normal_to_light));
+		//Set attribute sources:
+		if (pipeline.vao != current_vao) {
+			glBindVertexArray(pipeline.vao);
+			current_vao = pipeline.vao;
+			stats.vao_changes += 1;
 		}
 
-		//set any requested custom uniforms:
-		if (pipeline.set_uniforms) pipeline.set_uniforms();
+		if (run > 1) {
+			//stream per-instance matrices into the instance buffer:
+			instance_data.clear();
+			instance_data.reserve(run * InstanceTexels);
+			for (uint32_t i = batch.begin; i < batch.end; ++i) {
+				glm::mat4 object_to_clip;
+				glm::mat4x3 object_to_light;
+				glm::mat3 normal_to_light;
+				object_matrices(queue[i], &object_to_clip, &object_to_light, &normal_to_light);
+				for (uint32_t c = 0; c < 4; ++c) instance_data.emplace_back(object_to_clip[c]);
+				for (uint32_t c = 0; c < 4; ++c) instance_data.emplace_back(object_to_light[c], 0.0f);
+				for (uint32_t c = 0; c < 3; ++c) instance_data.emplace_back(normal_to_light[c], 0.0f);
+				ObjectLights const &list = object_lights[queue[i].visible];
+				float packed[12] = { float(list.count) };
+				for (uint32_t l = 0; l < list.count; ++l) packed[1 + l] = float(list.index[l]);
+				for (uint32_t t = 0; t < 3; ++t) instance_data.emplace_back(packed[4*t+0], packed[4*t+1], packed[4*t+2], packed[4*t+3]);
+			}
 
-		//set up textures:
-		for (uint32_t i = 0; i < Drawable::Pipeline::TextureCount; ++i) {
-			if (pipeline.textures[i].texture != 0) {
-				glActiveTexture(GL_TEXTURE0 + i);
-				glBindTexture(pipeline.textures[i].target, pipeline.textures[i].texture);
+			if (instance_buffer == 0) {
+				glGenBuffers(1, &instance_buffer);
+				glGenTextures(1, &instance_texture);
+				glBindBuffer(GL_TEXTURE_BUFFER, instance_buffer);
+				glBindTexture(GL_TEXTURE_BUFFER, instance_texture);
+				glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, instance_buffer);
+				glBindTexture(GL_TEXTURE_BUFFER, 0);
+				glBindBuffer(GL_TEXTURE_BUFFER, 0);
+			}
+			glBindBuffer(GL_TEXTURE_BUFFER, instance_buffer);
+			glBufferData(GL_TEXTURE_BUFFER, instance_data.size() * sizeof(glm::vec4), instance_data.data(), GL_STREAM_DRAW);
+			glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+			if (!instance_texture_bound) {
+				glActiveTexture(GL_TEXTURE0 + InstanceTextureUnit);
+				glBindTexture(GL_TEXTURE_BUFFER, instance_texture);
+				instance_texture_bound = true;
+				stats.texture_changes += 1;
+			}
+		} else if (pipeline.object_block) {
+			//point the 'Object' block at this drawable's matrices:
+			glBindBufferRange(GL_UNIFORM_BUFFER, ObjectBlockBinding, object_buffer, batch.object_offset, sizeof(ObjectBlock));
+
+			//set any requested custom uniforms:
+			apply_uniforms(pipeline);
+		} else {
+			//Configure program uniforms:
+			glm::mat4 object_to_clip;
+			glm::mat4x3 object_to_light;
+			glm::mat3 normal_to_light;
+			object_matrices(queue[batch.begin], &object_to_clip, &object_to_light, &normal_to_light);
+
+			if (pipeline.OBJECT_TO_CLIP_mat4 != -1U) {
+				glUniformMatrix4fv(pipeline.OBJECT_TO_CLIP_mat4, 1, GL_FALSE, glm::value_ptr(object_to_clip));
+			}
+			if (pipeline.OBJECT_TO_LIGHT_mat4x3 != -1U) {
+				glUniformMatrix4x3fv(pipeline.OBJECT_TO_LIGHT_mat4x3, 1, GL_FALSE, glm::value_ptr(object_to_light));
+			}
+			if (pipeline.NORMAL_TO_LIGHT_mat3 != -1U) {
+				glUniformMatrix3fv(pipeline.NORMAL_TO_LIGHT_mat3, 1, GL_FALSE, glm::value_ptr(normal_to_light));
 			}
-		}
 
-		//draw the object:
-		glDrawArrays(pipeline.type, pipeline.start, pipeline.count);
+			//set any requested custom uniforms:
+			apply_uniforms(pipeline);
+		}
 
-		//un-bind textures:
+		//set up textures (units the drawable doesn't use are left un-bound):
 		for (uint32_t i = 0; i < Drawable::Pipeline::TextureCount; ++i) {
-			if (pipeline.textures[i].texture != 0) {
-				glActiveTexture(GL_TEXTURE0 + i);
-				glBindTexture(pipeline.textures[i].target, 0);
+			auto const &want = pipeline.textures[i];
+			if (want.texture == bound[i].texture && (want.texture == 0 || want.target == bound[i].target)) continue;
+			glActiveTexture(GL_TEXTURE0 + i);
+			if (bound[i].texture != 0 && (want.texture == 0 || want.target != bound[i].target)) {
+				glBindTexture(bound[i].target, 0);
 			}
+			if (want.texture != 0) {
+				glBindTexture(want.target, want.texture);
+			}
+			bound[i] = want;
+			stats.texture_changes += 1;
 		}
-		glActiveTexture(GL_TEXTURE0);
 
+		//draw the object(s):
+		if (pipeline.index_type != GL_NONE) {
+			GLbyte const *first = (GLbyte const *)0 + start * index_size(pipeline.index_type);
+			if (run > 1) {
+				glDrawElementsInstanced(pipeline.type, count, pipeline.index_type, first, run);
+			} else {
+				glDrawElements(pipeline.type, count, pipeline.index_type, first);
+			}
+		} else {
+			if (run > 1) {
+				glDrawArraysInstanced(pipeline.type, start, count, run);
+			} else {
+				glDrawArrays(pipeline.type, start, count);
+			}
+		}
+		if (run > 1) {
+			stats.instanced_batches += 1;
+			stats.instanced_drawables += run;
+		}
 	}
 
+	if (instance_texture_bound) {
+		glActiveTexture(GL_TEXTURE0 + InstanceTextureUnit);
+		glBindTexture(GL_TEXTURE_BUFFER, 0);
+	}
+
+	//un-bind textures:
+	for (uint32_t i = 0; i < Drawable::Pipeline::TextureCount; ++i) {
+		if (bound[i].texture != 0) {
+			glActiveTexture(GL_TEXTURE0 + i);
+			glBindTexture(bound[i].target, 0);
+		}
+	}
+	glActiveTexture(GL_TEXTURE0);
+
+	glBindBufferBase(GL_UNIFORM_BUFFER, ObjectBlockBinding, 0);
+	glBindBufferBase(GL_UNIFORM_BUFFER, FrameBlockBinding, 0);
+	glBindBufferBase(GL_UNIFORM_BUFFER, LightsBlockBinding, 0);
+
 	glUseProgram(0);
 	glBindVertexArray(0);
 
@@ -166,13 +1222,42 @@ void Scene::draw(glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_lig
 }
 
 
+//copy the i'th record out of (possibly unaligned) chunk data:
+template< typename T >
+static T record(char const *data, size_t i) {
+	T ret;
+	std::memcpy(&ret, data + i * sizeof(T), sizeof(T));
+	return ret;
+}
+
+//read-only stream buffer over a block of memory (lets load_extra read the rest of a mapped file as a stream):
+struct MemoryStreamBuf : std::streambuf {
+	MemoryStreamBuf(char const *begin, char const *end) {
+		setg(const_cast< char * >(begin), const_cast< char * >(begin), const_cast< char * >(end));
+	}
+};
+
 void Scene::load(std::string const &filename,
 	std::function< void(Scene &, Transform *, std::string const &) > const &on_drawable) {
 
-	std::ifstream file(filename, std::ios::binary);
+	//the file is mapped into memory and read in place:
+	auto mapped = std::make_shared< MappedFile >(filename);
+	if (!mapped->data()) throw std::runtime_error("scene file '" + filename + "' is empty.");
+	load_mapped(mapped, mapped->data(), mapped->data() + mapped->size(), filename, on_drawable);
+}
 
-	std::vector< char > names;
-	read_chunk(file, "str0", &names);
+void Scene::load_mapped(std::shared_ptr< MappedFile const > const &mapped, char const *begin, char const *end, std::string const &filename,
+	std::function< void(Scene &, Transform *, std::string const &) > const &on_drawable) {
+	char const *at = begin;
+
+	//names stay in the mapped str0 chunk; transforms hold views into it:
+	size_t names_count;
+	char const *names_data = view_chunk< char >(&at, end, "str0", &names_count);
+	std::string_view names(names_data, names_count);
+	//(loading several ranges of one file only needs to keep it alive once)
+	if (std::find(name_storage.begin(), name_storage.end(), mapped) == name_storage.end()) {
+		name_storage.emplace_back(mapped);
+	}
 
 	struct HierarchyEntry {
 		uint32_t parent;
@@ -183,8 +1268,8 @@ void Scene::load(std::string const &filename,
 		glm::vec3 scale;
 	};
 	static_assert(sizeof(HierarchyEntry) == 4 + 4 + 4 + 4*3 + 4*4 + 4*3, "HierarchyEntry is packed.");
-	std::vector< HierarchyEntry > hierarchy;
-	read_chunk(file, "xfh0", &hierarchy);
+	size_t hierarchy_count;
+	char const *hierarchy = view_chunk< HierarchyEntry >(&at, end, "xfh0", &hierarchy_count);
 
 	struct MeshEntry {
 		uint32_t transform;
@@ -192,8 +1277,8 @@ void Scene::load(std::string const &filename,
 		uint32_t name_end;
 	};
 	static_assert(sizeof(MeshEntry) == 4 + 4 + 4, "MeshEntry is packed.");
-	std::vector< MeshEntry > meshes;
-	read_chunk(file, "msh0", &meshes);
+	size_t meshes_count;
+	char const *meshes = view_chunk< MeshEntry >(&at, end, "msh0", &meshes_count);
 
 	struct CameraEntry {
 		uint32_t transform;
@@ -202,8 +1287,8 @@ void Scene::load(std::string const &filename,
 		float clip_near, clip_far;
 	};
 	static_assert(sizeof(CameraEntry) == 4 + 4 + 4 + 4 + 4, "CameraEntry is packed.");
-	std::vector< CameraEntry > loaded_cameras;
-	read_chunk(file, "cam0", &loaded_cameras);
+	size_t cameras_count;
+	char const *loaded_cameras = view_chunk< CameraEntry >(&at, end, "cam0", &cameras_count);
 
 	struct LightEntry {
 		uint32_t transform;
@@ -214,17 +1299,18 @@ void Scene::load(std::string const &filename,
 		float fov;
 	};
 	static_assert(sizeof(LightEntry) == 4 + 1 + 3 + 4 + 4 + 4, "LightEntry is packed.");
-	std::vector< LightEntry > loaded_lights;
-	read_chunk(file, "lmp0", &loaded_lights);
+	size_t lights_count;
+	char const *loaded_lights = view_chunk< LightEntry >(&at, end, "lmp0", &lights_count);
 
 
 	//--------------------------------
 	//Now that file is loaded, create transforms for hierarchy entries:
 
 	std::vector< Transform * > hierarchy_transforms;
-	hierarchy_transforms.reserve(hierarchy.size());
+	hierarchy_transforms.reserve(hierarchy_count);
 
-	for (auto const &h : hierarchy) {
+	for (size_t i = 0; i < hierarchy_count; ++i) {
+		HierarchyEntry h = record< HierarchyEntry >(hierarchy, i);
 		transforms.emplace_back();
 		Transform *t = &transforms.back();
 		if (h.parent != -1U) {
@@ -235,7 +1321,7 @@ void Scene::load(std::string const &filename,
 		}
 
 		if (h.name_begin <= h.name_end && h.name_end <= names.size()) {
-			t->name = std::string(names.begin() + h.name_begin, names.begin() + h.name_end);
+			t->name = names.substr(h.name_begin, h.name_end - h.name_begin);
 		} else {
 				throw std::runtime_error("scene file '" + filename + "' contains hierarchy entry with invalid name indices");
 		}
@@ -246,16 +1332,17 @@ void Scene::load(std::string const &filename,
 
 		hierarchy_transforms.emplace_back(t);
 	}
-	assert(hierarchy_transforms.size() == hierarchy.size());
+	assert(hierarchy_transforms.size() == hierarchy_count);
 
-	for (auto const &m : meshes) {
+	for (size_t i = 0; i < meshes_count; ++i) {
+		MeshEntry m = record< MeshEntry >(meshes, i);
 		if (m.transform >= hierarchy_transforms.size()) {
 			throw std::runtime_error("scene file '" + filename + "' contains mesh entry with invalid transform index (" + std::to_string(m.transform) + ")");
 		}
 		if (!(m.name_begin <= m.name_end && m.name_end <= names.size())) {
 			throw std::runtime_error("scene file '" + filename + "' contains mesh entry with invalid name indices");
 		}
-		std::string name = std::string(names.begin() + m.name_begin, names.begin() + m.name_end);
+		std::string name = std::string(names.substr(m.name_begin, m.name_end - m.name_begin));
 
 		if (on_drawable) {
 			on_drawable(*this, hierarchy_transforms[m.transform], name);
@@ -263,7 +1350,8 @@ void Scene::load(std::string const &filename,
 
 	}
 
-	for (auto const &c : loaded_cameras) {
+	for (size_t i = 0; i < cameras_count; ++i) {
+		CameraEntry c = record< CameraEntry >(loaded_cameras, i);
 		if (c.transform >= hierarchy_transforms.size()) {
 			throw std::runtime_error("scene file '" + filename + "' contains camera entry with invalid transform index (" + std::to_string(c.transform) + ")");
 		}
@@ -278,7 +1366,8 @@ void Scene::load(std::string const &filename,
 		//N.b. far plane is ignored because cameras use infinite perspective matrices.
 	}
 
-	for (auto const &l : loaded_lights) {
+	for (size_t i = 0; i < lights_count; ++i) {
+		LightEntry l = record< LightEntry >(loaded_lights, i);
 		if (l.transform >= hierarchy_transforms.size()) {
 			throw std::runtime_error("scene file '" + filename + "' contains lamp entry with invalid transform index (" + std::to_string(l.transform) + ")");
 		}
@@ -299,9 +1388,17 @@ void Scene::load(std::string const &filename,
 		light->type = static_cast<Light::Type>(l.type);
 		light->energy = glm::vec3(l.color) / 255.0f * l.energy;
 		light->spot_fov = l.fov / 180.0f * 3.1415926f; //FOV is stored in degrees; convert to radians.
+		light->distance = l.distance;
+	}
+
+	//(only the new transforms are added, so loading into a large scene doesn't re-index what's already there)
+	for (auto t : hierarchy_transforms) {
+		index_name(t);
 	}
 
 	//load any extra that a subclass wants:
+	MemoryStreamBuf rest(at, end);
+	std::istream file(&rest);
 	load_extra(file, names, hierarchy_transforms);
 
 	if (file.peek() != EOF) {
@@ -327,51 +1424,127 @@ Scene &Scene::operator=(Scene const &other) {
 	return *this;
 }
 
-void Scene::set(Scene const &other, std::unordered_map< Transform const *, Transform * > *transform_map_) {
-
-	std::unordered_map< Transform const *, Transform * > t2t_temp;
-	std::unordered_map< Transform const *, Transform * > &transform_to_transform = *(transform_map_ ? transform_map_ : &t2t_temp);
-
-	transform_to_transform.clear();
-
-	//null transform maps to itself:
-	transform_to_transform.insert(std::make_pair(nullptr, nullptr));
+void Scene::set(Scene const &other, std::unordered_map< Transform const *, Transform * > *transform_map) {
+	//Pointers are remapped through indices: other's transforms are numbered in list order, and a flat
+	// open-addressed table (one allocation, no per-node hashing) turns any old Transform pointer into that index:
+	uint32_t capacity = 16;
+	while (capacity < 2 * other.transforms.size()) capacity *= 2;
+	struct Slot {
+		Transform const *key = nullptr;
+		uint32_t index = 0;
+	};
+	std::vector< Slot > old_index(capacity);
+	auto slot_for = [&](Transform const *t) -> uint32_t {
+		uint64_t h = uint64_t(reinterpret_cast< uintptr_t >(t)) * 0x9e3779b97f4a7c15ULL;
+		uint32_t s = uint32_t(h >> 32) & (capacity - 1);
+		while (old_index[s].key != nullptr && old_index[s].key != t) s = (s + 1) & (capacity - 1);
+		return s;
+	};
+	{
+		uint32_t index = 0;
+		for (auto const &t : other.transforms) {
+			Slot &slot = old_index[slot_for(&t)];
+			slot.key = &t;
+			slot.index = index++;
+		}
+	}
 
-	//Copy transforms and store mapping:
+	//Copy transforms (including their cached world matrices), remembering the new transform at each index:
+	std::vector< Transform * > new_transform;
+	new_transform.reserve(other.transforms.size());
 	transforms.clear();
 	for (auto const &t : other.transforms) {
 		transforms.emplace_back();
-		transforms.back().name = t.name;
-		transforms.back().position = t.position;
-		transforms.back().rotation = t.rotation;
-		transforms.back().scale = t.scale;
-		transforms.back().parent = t.parent; //will update later
-
-		//store mapping between transforms old and new:
-		auto ret = transform_to_transform.insert(std::make_pair(&t, &transforms.back()));
-		assert(ret.second);
+		Transform &copy = transforms.back();
+		copy.name = t.name;
+		copy.position = t.position;
+		copy.rotation = t.rotation;
+		copy.scale = t.scale;
+		copy.world_cache = t.world_cache; //(pointers fixed below)
+		new_transform.emplace_back(&copy);
 	}
 
+	auto remap = [&](Transform const *t) -> Transform * {
+		if (!t) return nullptr;
+		Slot const &slot = old_index[slot_for(t)];
+		if (slot.key != t) {
+			throw std::runtime_error("Scene being copied references a transform it doesn't contain.");
+		}
+		return new_transform[slot.index];
+	};
+
 	//update transform parents:
+	auto o = other.transforms.begin();
 	for (auto &t : transforms) {
-		t.parent = transform_to_transform.at(t.parent);
+		t.parent = remap(o->parent);
+		//the cached matrices stay valid if they were built with the current parent:
+		if (o->world_cache.parent == o->parent) {
+			t.world_cache.parent = t.parent;
+		} else {
+			t.world_cache.generation = 0;
+		}
+		++o;
 	}
 
 	//copy other's drawables, updating transform pointers:
 	drawables = other.drawables;
 	for (auto &d : drawables) {
-		d.transform = transform_to_transform.at(d.transform);
+		d.transform = remap(d.transform);
 	}
 
 	//copy other's cameras, updating transform pointers:
 	cameras = other.cameras;
 	for (auto &c : cameras) {
-		c.transform = transform_to_transform.at(c.transform);
+		c.transform = remap(c.transform);
 	}
 
 	//copy other's lights, updating transform pointers:
 	lights = other.lights;
 	for (auto &l : lights) {
-		l.transform = transform_to_transform.at(l.transform);
+		l.transform = remap(l.transform);
+	}
+
+	//copy other's drawing settings:
+	frame_light = other.frame_light;
+	light_threshold = other.light_threshold;
+	instancing = other.instancing;
+	light_lists = other.light_lists;
+	frustum_culling = other.frustum_culling;
+	lod_selection = other.lod_selection;
+	lod_hysteresis = other.lod_hysteresis;
+	//(the hierarchy refers to other's drawables, so the copy gets its own -- built on first use)
+	bvh = (other.bvh ? std::make_shared< DrawableBVH >() : nullptr);
+	//(occluders are re-pointed at the copied transforms)
+	if (other.occlusion) {
+		occlusion = std::make_shared< OcclusionBuffer >(*other.occlusion);
+		for (auto &occluder : occlusion->occluders) {
+			occluder.transform = remap(occluder.transform);
+		}
+	} else {
+		occlusion = nullptr;
+	}
+
+	//names are views into shared, immutable blocks, so the index can be copied as-is:
+	name_storage = other.name_storage;
+	name_entries = other.name_entries;
+	name_table = other.name_table;
+	name_order = other.name_order;
+	name_order_dirty = other.name_order_dirty;
+	name_block = nullptr; //(new names go in a block of this scene's own)
+	for (auto &entry : name_entries) {
+		if (!entry.transform) continue;
+		//(entries for transforms no longer in 'other' -- i.e., a stale index -- are dropped)
+		Slot const &slot = old_index[slot_for(entry.transform)];
+		entry.transform = (slot.key == entry.transform ? new_transform[slot.index] : nullptr);
+	}
+
+	//only build the pointer-to-pointer map if asked for it:
+	if (transform_map) {
+		transform_map->clear();
+		transform_map->reserve(new_transform.size() + 1);
+		transform_map->insert(std::make_pair(nullptr, nullptr)); //null transform maps to itself
+		for (auto const &slot : old_index) {
+			if (slot.key) transform_map->insert(std::make_pair(slot.key, new_transform[slot.index]));
+		}
 	}
 }
@@ -15,17 +15,27 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/quaternion.hpp>
 
+#include <atomic>
+#include <limits>
 #include <list>
 #include <memory>
 #include <functional>
 #include <string>
+#include <string_view>
+#include <type_traits>
 #include <vector>
 #include <unordered_map>
 
+struct WorkerPool;
+struct DrawableBVH;
+struct OcclusionBuffer;
+struct MappedFile;
+
 struct Scene {
 	struct Transform {
 		//Transform names are useful for debugging and looking up locations in a loaded scene:
-		std::string name;
+		// (this is a view into character storage owned by the scene -- use Scene::set_name to change it)
+		std::string_view name;
 
 		//The core function of a transform is to store a transformation in the world:
 		glm::vec3 position = glm::vec3(0.0f, 0.0f, 0.0f);
@@ -40,9 +50,47 @@ struct Scene {
 		glm::mat4x3 make_local_to_parent() const;
 		glm::mat4x3 make_parent_to_local() const;
 		// ..relative to the world:
+		// (these return cached values; see 'local_to_world()' below)
 		glm::mat4x3 make_local_to_world() const;
 		glm::mat4x3 make_world_to_local() const;
 
+		//Cached world matrices, recomputed only when this transform or one of its ancestors changes:
+		// each call checks the values of this transform and its ancestors against the ones its cache was built
+		// from (no matrix math unless something changed), so writing position/rotation/scale/parent directly is fine.
+		// NOTE: though const, these write the caches of this transform and its ancestors -- they aren't safe to
+		//  call while another thread reads the same hierarchy or runs Scene::update_world_matrices().
+		glm::mat4x3 const &local_to_world() const;
+		glm::mat4x3 const &world_to_local() const;
+
+		//Generation counter, bumped every time this transform's cached world matrices are recomputed:
+		// (descendants store their parent's generation, so a change propagates down the hierarchy)
+		uint32_t world_generation() const;
+
+		//-- internals ---
+
+		//the values the cache was built from (so changes to this transform's own values are caught):
+		struct WorldCache {
+			glm::vec3 position = glm::vec3(0.0f);
+			glm::quat rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+			glm::vec3 scale = glm::vec3(1.0f);
+			Transform const *parent = nullptr;
+			uint32_t parent_generation = 0;
+
+			uint32_t generation = 0; //0 => never computed
+			glm::mat4x3 local_to_world = glm::mat4x3(1.0f);
+			glm::mat4x3 world_to_local = glm::mat4x3(1.0f);
+		};
+		mutable WorldCache world_cache;
+
+		//bring world_cache up to date with the current local values (and all ancestors):
+		void update_world_cache() const;
+		//...same, but assumes the parent's cache is already up to date (used by Scene::update_world_matrices):
+		void refresh_world_cache() const;
+		//depth in the hierarchy (roots are 0) as last derived by Scene::update_world_matrices:
+		mutable uint32_t world_level = 0;
+		//the Scene::update_world_matrices sweep that last reached this transform (when sweeping in list order):
+		mutable uint32_t world_sweep = 0;
+
 		//since hierarchy is tracked through pointers, copy-constructing a transform  is not advised:
 		Transform(Transform const &) = delete;
 		//if we delete some constructors, we need to let the compiler know that the default constructor is still okay:
@@ -54,6 +102,12 @@ struct Scene {
 		Drawable(Transform *transform_) : transform(transform_) { assert(transform); }
 		Transform * transform;
 
+		//(optional) object-space bounding box, used for culling:
+		// (the default -- empty -- box means "bounds unknown"; such drawables are never culled)
+		glm::vec3 min = glm::vec3( std::numeric_limits< float >::infinity());
+		glm::vec3 max = glm::vec3(-std::numeric_limits< float >::infinity());
+		bool has_bounds() const { return min.x <= max.x && min.y <= max.y && min.z <= max.z; }
+
 		//Contains all the data needed to run the OpenGL pipeline:
 		struct Pipeline {
 			GLuint program = 0; //shader program; passed to glUseProgram
@@ -65,12 +119,66 @@ struct Scene {
 			GLuint start = 0; //first vertex to draw; passed to glDrawArrays
 			GLuint count = 0; //number of vertices to draw; passed to glDrawArrays
 
+			//if set (e.g., from Mesh::index_type), start and count are a range of the element buffer bound in 'vao',
+			// drawn with glDrawElements instead:
+			GLenum index_type = GL_NONE; //GL_UNSIGNED_BYTE, GL_UNSIGNED_SHORT, or GL_UNSIGNED_INT
+
+			//(quantized meshes) object-space position == position_offset + position_scale * Position;
+			// draw() folds this into OBJECT_TO_CLIP and OBJECT_TO_LIGHT (not NORMAL_TO_LIGHT), so shaders needn't know:
+			// (copy from Mesh::position_offset / position_scale; levels of detail must share them)
+			glm::vec3 position_offset = glm::vec3(0.0f);
+			glm::vec3 position_scale = glm::vec3(1.0f);
+
 			//uniforms:
 			GLuint OBJECT_TO_CLIP_mat4 = -1U; //uniform location for object to clip space matrix
 			GLuint OBJECT_TO_LIGHT_mat4x3 = -1U; //uniform location for object to light space (== world space) matrix
 			GLuint NORMAL_TO_LIGHT_mat3 = -1U; //uniform location for normal to light space (== world space) matrix
 
-			std::function< void() > set_uniforms; //(optional) function to set any other useful uniforms
+			//if set, the program reads the above matrices from the 'Object' uniform block (see Scene::ObjectBlockGLSL)
+			// and draw() binds a range of its per-object buffer instead of calling glUniform*:
+			bool object_block = false;
+
+			//(optional) other uniforms to set before drawing, stored inline so the pipeline stays plain data:
+			// (e.g., pipeline.add_uniform(program->TINT_vec4, glm::vec4(1.0f, 0.0f, 0.0f, 1.0f)); )
+			struct Uniform {
+				enum Type : uint32_t {
+					Int, //glUniform1iv
+					Float, //glUniform1fv
+					Vec2, //glUniform2fv
+					Vec3, //glUniform3fv
+					Vec4, //glUniform4fv
+				};
+				GLuint location;
+				Type type;
+				union {
+					int32_t i[4];
+					float f[4];
+				} value;
+			};
+			enum : uint32_t { UniformCount = 4 };
+			Uniform uniforms[UniformCount];
+			uint32_t uniform_count = 0;
+
+			//append to 'uniforms' (throws if all UniformCount slots are used):
+			void add_uniform(GLuint location, int32_t value);
+			void add_uniform(GLuint location, float value);
+			void add_uniform(GLuint location, glm::vec2 const &value);
+			void add_uniform(GLuint location, glm::vec3 const &value);
+			void add_uniform(GLuint location, glm::vec4 const &value);
+
+			//(optional) program that can draw many copies of this mesh with one glDrawArraysInstanced:
+			// it must read per-instance matrices from the buffer texture on unit Scene::InstanceTextureUnit
+			// (see LitColorTextureProgram for the expected layout); uniforms other than those matrices
+			// must match 'program', since only drawables without extra 'uniforms' are batched.
+			GLuint instanced_program = 0;
+
+			//(optional) shader permutations -- if set, draw() draws with select_program(features, frame light type, instanced)
+			// instead of 'program' (or 'instanced_program', when batching), so a program can be compiled specialized
+			// for the frame light's type and the pipeline's features instead of branching on them per fragment.
+			// Variants must use the same attribute locations, uniforms, and blocks as 'program'.
+			// (e.g., LitColorTextureProgram::select_program)
+			uint32_t features = 0; //program-specific feature bits, passed to select_program
+			GLuint (*select_program)(uint32_t features, int32_t light_type, bool instanced) = nullptr;
 
 			//texture objects to bind for the first TextureCount textures:
 			enum : uint32_t { TextureCount = 4 };
@@ -79,6 +187,28 @@ struct Scene {
 				GLenum target = GL_TEXTURE_2D;
 			} textures[TextureCount];
 		} pipeline;
+		static_assert(std::is_trivially_copyable< Pipeline >::value, "Pipeline can be copied with memcpy");
+
+		//(optional) coarser levels of detail -- other vertex ranges drawn with the same pipeline:
+		// level 0 is pipeline.start/count; level i+1 draws lods[i] once the drawable's projected size
+		// falls below lods[i].screen_size (so screen_size should decrease with i).
+		// LOD selection needs bounds; drawables without them always draw level 0.
+		// (a level with count == 0 draws nothing -- handy for dropping small details in the distance)
+		struct LOD {
+			GLuint start = 0; //first vertex or element (primitive and index type are pipeline.type and pipeline.index_type)
+			GLuint count = 0; //number of vertices or elements
+			float screen_size = 0.0f; //projected bounds diameter, as a fraction of viewport height
+		};
+		enum : uint32_t { LODCount = 3 };
+		LOD lods[LODCount];
+		uint32_t lod_count = 0;
+
+		//append to 'lods' (throws if all LODCount slots are used):
+		void add_lod(GLuint start, GLuint count, float screen_size);
+
+		//level drawn by the most recent draw() (kept so levels only change past the hysteresis band):
+		// (draws with DrawOverrides::lods keep this state there instead)
+		mutable uint32_t lod = 0;
 	};
 
 	struct Camera {
@@ -114,6 +244,9 @@ struct Scene {
 
 		//Spotlight specific:
 		float spot_fov = glm::radians(45.0f); //spot cone fov (in radians)
+
+		//Point/spot range; light fades to nothing at this distance (0 => derived from energy; see Scene::light_threshold):
+		float distance = 0.0f;
 	};
 
 	//Scenes, of course, may have many of the above objects:
@@ -122,11 +255,165 @@ struct Scene {
 	std::list< Camera > cameras;
 	std::list< Light > lights;
 
+	//Transform names:
+	// names are views into immutable character blocks kept alive here; for a loaded scene, that's
+	// the file's "str0" chunk in the memory-mapped file, so no per-transform string is allocated.
+	// Copies of a scene share the blocks.
+	std::vector< std::shared_ptr< void const > > name_storage;
+
+	//give 'transform' a name and (re-)index it under that name:
+	// the characters are shared with any indexed transform of the same name (e.g., in str0);
+	// new names are appended to a scene-owned block in name_storage.
+	void set_name(Transform *transform, std::string_view name);
+
+	//find a transform by name in O(1); returns nullptr if none (if several share a name, returns one of them):
+	Transform *find_transform(std::string_view name) const;
+	//all transforms whose names begin with 'prefix', in name order:
+	// (the name order is re-sorted here, once, after any set_name calls -- so naming many transforms stays linear)
+	std::vector< Transform * > find_transforms_with_prefix(std::string_view prefix) const;
+
+	//the name index is built by set(), extended by load(), and kept current by set_name();
+	// when adding or removing transforms some other way, either index_name() / unindex_name() each one
+	// (e.g., unindex before erasing) or rebuild the whole index afterward:
+	void index_name(Transform *transform);
+	void unindex_name(Transform const *transform); //(does nothing if 'transform' isn't indexed)
+	void rebuild_name_index();
+
+	//-- name index internals (flat arrays, so copying a scene copies the index without rehashing):
+	struct NameEntry {
+		std::string_view name;
+		Transform *transform; //(null only for entries of transforms missing from a copied scene)
+	};
+	std::vector< NameEntry > name_entries; //one per indexed transform
+	std::vector< uint32_t > name_table; //open-addressed (linear probing) hash table of indices into name_entries (-1U => empty slot)
+	mutable std::vector< uint32_t > name_order; //indices into name_entries sorted by name, for prefix queries
+	mutable bool name_order_dirty = false; //name_order needs re-sorting
+	void insert_name_entry(uint32_t entry); //add an entry to name_table, growing it as needed
+	void erase_name_entry(uint32_t entry); //remove an entry from name_table and name_entries (the last entry takes its index)
+	std::string_view intern_name(std::string_view name); //characters for 'name' that live as long as name_storage
+	std::shared_ptr< std::vector< char > > name_block; //block new names are appended to (never grows past its capacity)
+
+	//Bring every transform's cached world matrices up to date:
+	// groups the hierarchy into depth levels and sweeps them parents-first, splitting each level across 'pool'
+	// (if 'pool' is null, uses WorkerPool::shared()).
+	// Small scenes (or an empty pool) are instead swept once in list order on the calling thread, which is already
+	// parents-first for scenes built parents-first; transforms whose parent comes later fall back to local_to_world()'s chain walk.
+	// Either way, each transform's matrices are computed once, from its already-updated parent.
+	// Calling this before draw() means draw() only ever reads already-computed matrices.
+	// Depths are kept in the transforms (Transform::world_level) and only re-derived when one no longer
+	// matches its parent's (after a transform was added or re-parented); checking takes one pass, without hashing.
+	void update_world_matrices(WorkerPool *pool = nullptr) const;
+
+	//-- update_world_matrices internals:
+	// (transforms sorted by depth, with level d at [level_begin[d], level_begin[d+1]); rebuilt each call by counting sort)
+	mutable std::vector< Transform const * > world_by_level;
+	mutable std::vector< uint32_t > world_level_begin;
+
+	//draw() batches drawables that share a pipeline and mesh range into instanced draws
+	// (when the pipeline has an instanced_program; unless this is turned off):
+	bool instancing = true;
+	enum : uint32_t { InstanceTextureUnit = Drawable::Pipeline::TextureCount }; //texture unit used for per-instance data
+
+	//Uniform blocks:
+	// programs can read per-frame and per-object data from std140 uniform blocks instead of plain uniforms.
+	// draw() uploads the 'Frame' block once per call and writes every drawable's 'Object' block
+	// into one streamed buffer, binding a range of it per draw.
+	enum : GLuint {
+		ObjectBlockBinding = 0, //binding point used for the 'Object' block
+		FrameBlockBinding = 1, //binding point used for the 'Frame' block
+		LightsBlockBinding = 2, //binding point used for the 'Lights' block
+	};
+	static char const *ObjectBlockGLSL; //GLSL declaration of the 'Object' block (OBJECT_TO_CLIP, OBJECT_TO_LIGHT, NORMAL_TO_LIGHT, LIGHT_COUNT, LIGHT_INDICES)
+	static char const *FrameBlockGLSL; //GLSL declaration of the 'Frame' block (WORLD_TO_CLIP, WORLD_TO_LIGHT, LIGHT_*)
+	static char const *LightsBlockGLSL; //GLSL declaration of the 'Lights' block (LIGHTS[])
+	//attach a program's 'Object', 'Frame', and 'Lights' blocks (where present) to the binding points above:
+	static void bind_uniform_blocks(GLuint program);
+
+	//light parameters that draw() writes to the 'Frame' block:
+	struct FrameLight {
+		int32_t type = 1; //0: point; 1: hemisphere; 2: spot; 3: directional
+		glm::vec3 location = glm::vec3(0.0f);
+		glm::vec3 direction = glm::vec3(0.0f, 0.0f,-1.0f);
+		glm::vec3 energy = glm::vec3(1.0f);
+		float cutoff = 1.0f; //cosine of spot half-angle
+	} frame_light;
+
+	//Light lists:
+	// draw() uploads the 'lights' in view to the 'Lights' block and gives each drawable a list of
+	// the (at most MaxObjectLights) lights that reach its bounds -- through its 'Object' block or, when instanced,
+	// its instance data -- so shading cost depends on the lights near each object, not the lights in the scene.
+	// (hemisphere and directional lights reach everything, so they come first in the 'Lights' block and are applied to
+	//  every drawable without taking list slots; frame_light is applied in addition to all of these)
+	bool light_lists = true;
+	enum : uint32_t {
+		MaxFrameLights = 256, //lights in view uploaded per draw() (must match LightsBlockGLSL)
+		MaxObjectLights = 8, //point/spot lights per drawable; the brightest (at the drawable) are kept (must match ObjectBlockGLSL)
+	};
+	//energy below which a light is taken to have no effect (gives the range of point/spot lights with distance == 0):
+	float light_threshold = 1.0f / 256.0f;
+
+	//draw() skips drawables whose bounds fall outside the view frustum (unless this is turned off):
+	bool frustum_culling = true;
+
+	//draw() picks drawables' levels of detail from their projected size (turn off for, e.g., shadow passes):
+	bool lod_selection = true;
+	//fraction past a level's screen_size threshold before switching to/from it (avoids popping back and forth at the boundary):
+	float lod_hysteresis = 0.15f;
+
+	//(optional) bounding volume hierarchy over drawables:
+	// if set, draw() updates it and uses it for frustum culling; it can also answer ray/box queries
+	// (e.g., scene.bvh = std::make_shared< DrawableBVH >(); )
+	std::shared_ptr< DrawableBVH > bvh;
+
+	//(optional) CPU occlusion culling:
+	// if set, draw() rasterizes its occluders and skips drawables hidden behind them
+	// (e.g., scene.occlusion = std::make_shared< OcclusionBuffer >(); scene.occlusion->add_box_occluder(...); )
+	std::shared_ptr< OcclusionBuffer > occlusion;
+
+	//Counters from the most recent call to draw():
+	struct DrawStats {
+		uint32_t tested = 0; //drawables with bounds that were tested against the frustum
+		uint32_t culled = 0; //...of which this many were found to be off-screen
+		uint32_t occluded = 0; //drawables in the frustum but hidden behind occluders
+		uint32_t drawn = 0; //drawables actually submitted to OpenGL
+		//state changes emitted while submitting (draws are sorted to keep these low):
+		uint32_t program_changes = 0; //glUseProgram calls
+		uint32_t vao_changes = 0; //glBindVertexArray calls
+		uint32_t texture_changes = 0; //glBindTexture calls
+		//instancing:
+		uint32_t instanced_batches = 0; //glDrawArraysInstanced calls
+		uint32_t instanced_drawables = 0; //drawables drawn as part of those batches
+		//uniform blocks:
+		uint32_t object_blocks = 0; //'Object' blocks written to the per-object buffer
+		//levels of detail:
+		uint32_t lod_reduced = 0; //drawables drawn at a coarser level than their full-detail mesh
+		uint32_t lod_switches = 0; //drawables whose level changed since the previous draw()
+		//light lists:
+		uint32_t lights_in_view = 0; //lights uploaded to the 'Lights' block
+		uint32_t light_assignments = 0; //total length of all drawables' light lists
+		uint32_t lights_dropped = 0; //lights left off lists (past MaxFrameLights in view, or MaxObjectLights per drawable)
+	};
+	mutable DrawStats draw_stats;
+
 	//The "draw" function provides a convenient way to pass all the things in a scene to OpenGL:
 	void draw(Camera const &camera) const;
 
 	//..sometimes, you want to draw with a custom projection matrix and/or light space:
-	void draw(glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_light = glm::mat4x3(1.0f)) const;
+	// ('overrides', if given, replaces some of the scene's data for this call only; see SceneInstance)
+	// A draw with overrides keeps its per-call state in the overrides, culls linearly (the bvh isn't updated),
+	// and only occludes with overrides->occlusion. It reads transforms' cached world matrices as they stand,
+	// without refreshing them, so call update_world_matrices() after changing the scene itself.
+	// (like any draw, it uses OpenGL and scratch buffers shared by all scenes, so it's for the OpenGL thread only)
+	// Per-drawable entries are indexed by the drawable's position in 'drawables'.
+	struct DrawOverrides {
+		std::vector< glm::mat4x3 const * > const *world = nullptr; //(if non-null) each drawable's local_to_world, used instead of its transform's
+		std::unordered_map< Transform const *, glm::mat4x3 > const *transform_world = nullptr; //(if non-null) local_to_world of transforms (e.g., of lights and occluders) that differ from their cached matrices
+		std::vector< uint32_t > *lods = nullptr; //(if non-null) each drawable's level of detail state, used instead of Drawable::lod (resized to fit)
+		DrawStats *stats = nullptr; //(if non-null) written instead of draw_stats
+		OcclusionBuffer *occlusion = nullptr; //(if non-null) used instead of 'occlusion'
+		FrameLight const *frame_light = nullptr; //(if non-null) used instead of 'frame_light'
+	};
+	void draw(glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_light = glm::mat4x3(1.0f), DrawOverrides const *overrides = nullptr) const;
 
 	//add transforms/objects/cameras from a scene file to this scene:
 	// the 'on_drawable' callback gives your code a chance to look up mesh data and make Drawables:
@@ -135,9 +422,16 @@ struct Scene {
 		std::function< void(Scene &, Transform *, std::string const &) > const &on_drawable = nullptr
 	);
 
+	//...same, but reading the scene chunks in [begin,end) of an already-mapped file:
+	// (used by StreamingScene to load cells of a partitioned scene; 'filename' is only used in error messages)
+	void load_mapped(std::shared_ptr< MappedFile const > const &mapped, char const *begin, char const *end, std::string const &filename,
+		std::function< void(Scene &, Transform *, std::string const &) > const &on_drawable = nullptr
+	);
+
 	//this function is called to read extra chunks from the scene file after the main chunks are read:
 	// this is useful if you, e.g., subclassing scene to represent a game level/area
-	virtual void load_extra(std::istream &from, std::vector< char > const &str0, std::vector< Transform * > const &xfh0) { }
+	// ('str0' views the scene file's string chunk; it stays valid as long as this scene's name_storage does)
+	virtual void load_extra(std::istream &from, std::string_view str0, std::vector< Transform * > const &xfh0) { }
 
 	//empty scene:
 	Scene() = default;
@@ -146,6 +440,8 @@ struct Scene {
 	Scene(std::string const &filename, std::function< void(Scene &, Transform *, std::string const &) > const &on_drawable);
 
 	//copy a scene (with proper pointer fixup):
+	// (drawing settings -- frame_light, light_threshold, the culling/instancing/LOD switches -- and occluders are copied too;
+	//  if the scene has a bvh, the copy gets a new one)
 	Scene(Scene const &); //...as a constructor
 	Scene &operator=(Scene const &); //...as scene = scene
 	//... as a set() function that optionally returns the transform->transform mapping:
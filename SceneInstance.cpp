@@ -0,0 +1,189 @@
+#include "SceneInstance.hpp"
+
+#include <cassert>
+
+//same math as Scene::Transform::make_local_to_parent():
+static glm::mat4x3 make_local_to_parent(SceneInstance::Local const &local) {
+	glm::mat3 rot = glm::mat3_cast(local.rotation);
+	return glm::mat4x3(
+		rot[0] * local.scale.x,
+		rot[1] * local.scale.y,
+		rot[2] * local.scale.z,
+		local.position
+	);
+}
+
+//same math as Scene::Transform::make_parent_to_local():
+static glm::mat4x3 make_parent_to_local(SceneInstance::Local const &local) {
+	glm::vec3 inv_scale;
+	inv_scale.x = (local.scale.x == 0.0f ? 0.0f : 1.0f / local.scale.x);
+	inv_scale.y = (local.scale.y == 0.0f ? 0.0f : 1.0f / local.scale.y);
+	inv_scale.z = (local.scale.z == 0.0f ? 0.0f : 1.0f / local.scale.z);
+
+	glm::mat3 inv_rot = glm::mat3_cast(glm::inverse(local.rotation));
+	inv_rot[0] *= inv_scale;
+	inv_rot[1] *= inv_scale;
+	inv_rot[2] *= inv_scale;
+
+	return glm::mat4x3(
+		inv_rot[0],
+		inv_rot[1],
+		inv_rot[2],
+		inv_rot * -local.position
+	);
+}
+
+SceneInstance::SceneInstance(Scene const &base_) : base(base_), cameras(base_.cameras), frame_light(base_.frame_light) {
+	//instances read the template's cached matrices for everything they haven't edited:
+	base.update_world_matrices();
+
+	drawable_transforms.reserve(base.drawables.size());
+	drawable_world.reserve(base.drawables.size());
+	for (auto const &drawable : base.drawables) {
+		assert(drawable.transform); //drawables *must* have a transform
+		drawable_transforms.emplace_back(drawable.transform);
+		drawable_world.emplace_back(&drawable.transform->world_cache.local_to_world);
+	}
+	lods.assign(base.drawables.size(), 0);
+
+	if (base.occlusion) occlusion = std::make_shared< OcclusionBuffer >(*base.occlusion);
+}
+
+SceneInstance::Local SceneInstance::local(Scene::Transform const *transform) const {
+	assert(transform);
+	auto f = edits.find(transform);
+	if (f != edits.end()) return f->second;
+	Local ret;
+	ret.position = transform->position;
+	ret.rotation = transform->rotation;
+	ret.scale = transform->scale;
+	return ret;
+}
+
+SceneInstance::Local &SceneInstance::edit(Scene::Transform const *transform) {
+	assert(transform);
+	auto f = edits.find(transform);
+	if (f == edits.end()) {
+		f = edits.emplace(transform, local(transform)).first;
+
+		auto is_below = [transform](Scene::Transform const *t) {
+			for (; t; t = t->parent) {
+				if (t == transform) return true;
+			}
+			return false;
+		};
+
+		//drawables at or below 'transform' now get their matrices from edited_world:
+		for (uint32_t d = 0; d < drawable_transforms.size(); ++d) {
+			if (drawable_world[d] != &drawable_transforms[d]->world_cache.local_to_world) continue; //(already edited)
+			if (is_below(drawable_transforms[d])) drawable_world[d] = &edited_world[drawable_transforms[d]];
+		}
+		//...as do lights and occluders:
+		for (auto const &light : base.lights) {
+			if (is_below(light.transform)) edited_world[light.transform];
+		}
+		if (occlusion) {
+			for (auto const &o : occlusion->occluders) {
+				if (is_below(o.transform)) edited_world[o.transform];
+			}
+		}
+	}
+	return f->second;
+}
+
+void SceneInstance::revert(Scene::Transform const *transform) {
+	if (!edits.erase(transform)) return;
+
+	//drawables no longer under any edit go back to the template's matrices:
+	for (uint32_t d = 0; d < drawable_transforms.size(); ++d) {
+		if (drawable_world[d] == &drawable_transforms[d]->world_cache.local_to_world) continue;
+		if (!is_edited(drawable_transforms[d])) drawable_world[d] = &drawable_transforms[d]->world_cache.local_to_world;
+	}
+	for (auto e = edited_world.begin(); e != edited_world.end(); /* later */) {
+		if (is_edited(e->first)) ++e;
+		else e = edited_world.erase(e);
+	}
+}
+
+void SceneInstance::revert_all() {
+	edits.clear();
+	for (uint32_t d = 0; d < drawable_transforms.size(); ++d) {
+		drawable_world[d] = &drawable_transforms[d]->world_cache.local_to_world;
+	}
+	edited_world.clear();
+}
+
+bool SceneInstance::is_edited(Scene::Transform const *transform) const {
+	if (edits.empty()) return false;
+	for (Scene::Transform const *t = transform; t; t = t->parent) {
+		if (edits.count(t)) return true;
+	}
+	return false;
+}
+
+void SceneInstance::edited_chain(Scene::Transform const *transform, std::vector< Scene::Transform const * > *chain_) const {
+	assert(chain_);
+	auto &chain = *chain_;
+	chain.clear();
+	if (edits.empty()) return;
+	size_t topmost = 0; //(chain length up to and including the topmost edited transform)
+	for (Scene::Transform const *t = transform; t; t = t->parent) {
+		chain.emplace_back(t);
+		if (edits.count(t)) topmost = chain.size();
+	}
+	chain.resize(topmost);
+}
+
+//(the template's cached matrices are read directly -- refreshing them would write to the shared template)
+
+glm::mat4x3 SceneInstance::make_local_to_world(Scene::Transform const *transform) const {
+	assert(transform);
+	std::vector< Scene::Transform const * > chain;
+	edited_chain(transform, &chain);
+	if (chain.empty()) return transform->world_cache.local_to_world;
+
+	//start above the topmost edit and work down:
+	Scene::Transform const *above = chain.back()->parent;
+	glm::mat4x3 local_to_world = (above ? above->world_cache.local_to_world : glm::mat4x3(1.0f));
+	for (auto t = chain.rbegin(); t != chain.rend(); ++t) {
+		local_to_world = local_to_world * glm::mat4(make_local_to_parent(local(*t))); //note: glm::mat4(glm::mat4x3) pads with a (0,0,0,1) row
+	}
+	return local_to_world;
+}
+
+glm::mat4x3 SceneInstance::make_world_to_local(Scene::Transform const *transform) const {
+	assert(transform);
+	std::vector< Scene::Transform const * > chain;
+	edited_chain(transform, &chain);
+	if (chain.empty()) return transform->world_cache.world_to_local;
+
+	Scene::Transform const *above = chain.back()->parent;
+	glm::mat4x3 world_to_local = (above ? above->world_cache.world_to_local : glm::mat4x3(1.0f));
+	for (auto t = chain.rbegin(); t != chain.rend(); ++t) {
+		world_to_local = make_parent_to_local(local(*t)) * glm::mat4(world_to_local);
+	}
+	return world_to_local;
+}
+
+void SceneInstance::draw(Scene::Camera const &camera) const {
+	assert(camera.transform);
+	glm::mat4 world_to_clip = camera.make_projection() * glm::mat4(make_world_to_local(camera.transform));
+	glm::mat4x3 world_to_light = glm::mat4x3(1.0f);
+	draw(world_to_clip, world_to_light);
+}
+
+void SceneInstance::draw(glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_light) const {
+	//only drawables under an edited transform need matrices different from the template's:
+	for (auto &e : edited_world) {
+		e.second = make_local_to_world(e.first);
+	}
+
+	Scene::DrawOverrides overrides;
+	overrides.world = &drawable_world;
+	overrides.transform_world = &edited_world;
+	overrides.lods = &lods;
+	overrides.stats = &draw_stats;
+	overrides.occlusion = occlusion.get();
+	overrides.frame_light = &frame_light;
+	base.draw(world_to_clip, world_to_light, &overrides);
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+/*
+ * SceneInstance is a lightweight, copy-on-write view of a loaded Scene.
+ *
+ * The template scene (names, hierarchy, drawables, initial transforms) is
+ *  shared and never modified; an instance only stores the local transforms
+ *  that were changed through it. This makes it cheap to spin up many
+ *  sessions (or replays) from one Load< Scene >:
+ *
+ *  SceneInstance instance(*level_scene);
+ *  instance.edit(door).rotation = ...;   //first write copies 'door' into the instance
+ *  instance.draw(instance.cameras.front());
+ *
+ * Transforms are referred to by their pointers in the template scene.
+ * The hierarchy (parents) and the set of drawables come from the template.
+ *
+ * The template's world matrices are brought up to date when an instance is
+ *  made; after that, instances only read the template's cached matrices
+ *  (they never refresh them), so don't change the template while instances
+ *  of it are in use.
+ *
+ * Levels of detail, draw statistics, and the occlusion buffer are per
+ *  instance (see Scene::DrawOverrides), and lights and occluders follow the
+ *  instance's edits. (the template's bvh isn't used)
+ * Instances are not safe to use from several threads at once: drawing uses
+ *  OpenGL and scratch buffers shared by all scenes.
+ *
+ */
+
+#include "Scene.hpp"
+#include "OcclusionBuffer.hpp"
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+struct SceneInstance {
+	SceneInstance(Scene const &base);
+	//(drawable_world points into this instance's own storage, so instances aren't copyable)
+	SceneInstance(SceneInstance const &) = delete;
+
+	Scene const &base;
+
+	//local (parent-relative) transformation of one transform:
+	struct Local {
+		glm::vec3 position = glm::vec3(0.0f);
+		glm::quat rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f); //n.b. wxyz init order
+		glm::vec3 scale = glm::vec3(1.0f);
+	};
+
+	//current local transformation (this instance's copy if edited, otherwise the template's):
+	Local local(Scene::Transform const *transform) const;
+
+	//writable local transformation; copied from the template on first use:
+	Local &edit(Scene::Transform const *transform);
+
+	//forget this instance's changes to a transform (or to all transforms):
+	void revert(Scene::Transform const *transform);
+	void revert_all();
+
+	//number of transforms this instance has its own copy of:
+	size_t edited_count() const { return edits.size(); }
+
+	//world matrices, taking this instance's edits to the transform and its ancestors into account:
+	glm::mat4x3 make_local_to_world(Scene::Transform const *transform) const;
+	glm::mat4x3 make_world_to_local(Scene::Transform const *transform) const;
+
+	//per-instance copies of the template's cameras (so, e.g., aspect can differ between instances):
+	// (their transform pointers refer to the template's transforms)
+	std::list< Scene::Camera > cameras;
+
+	//per-instance light, passed to the 'Frame' uniform block when drawing:
+	Scene::FrameLight frame_light;
+
+	//per-instance copy of the template's occlusion buffer (if it has one):
+	std::shared_ptr< OcclusionBuffer > occlusion;
+
+	//draw the template's drawables with this instance's transforms:
+	void draw(Scene::Camera const &camera) const;
+	void draw(glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_light = glm::mat4x3(1.0f)) const;
+
+	//counters from this instance's most recent draw():
+	mutable Scene::DrawStats draw_stats;
+
+	//-- internals ---
+	std::unordered_map< Scene::Transform const *, Local > edits;
+
+	//world matrix of each template drawable (by position in base.drawables), passed as Scene::DrawOverrides::world:
+	// points at the template's cached matrix, or -- for drawables under an edited transform -- at edited_world.
+	// (updated only when a transform is first edited or reverted; edited_world is recomputed per draw)
+	std::vector< Scene::Transform const * > drawable_transforms;
+	std::vector< glm::mat4x3 const * > drawable_world;
+	//world matrices of the drawable, light, and occluder transforms under an edited transform:
+	// (passed as Scene::DrawOverrides::transform_world)
+	mutable std::unordered_map< Scene::Transform const *, glm::mat4x3 > edited_world;
+	//level of detail state for each template drawable (Scene::DrawOverrides::lods):
+	mutable std::vector< uint32_t > lods;
+
+	//does this transform (or any ancestor) have an edit?
+	bool is_edited(Scene::Transform const *transform) const;
+	//the chain from 'transform' up to its topmost edited ancestor (empty if nothing on the way up is edited):
+	void edited_chain(Scene::Transform const *transform, std::vector< Scene::Transform const * > *chain) const;
+};
@@ -1,5 +1,6 @@
 #include "ShowMeshesProgram.hpp"
 
+#include "Mesh.hpp"
 #include "gl_compile_program.hpp"
 #include "gl_errors.hpp"
 
@@ -88,6 +89,7 @@ ShowMeshesProgram::ShowMeshesProgram() {
 }
 
 ShowMeshesProgram::~ShowMeshesProgram() {
+	MeshBuffer::forget_program(program);
 	glDeleteProgram(program);
 	program = 0;
 }
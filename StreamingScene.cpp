@@ -0,0 +1,233 @@
+#include "StreamingScene.hpp"
+
+#include "DrawableBVH.hpp"
+#include "MappedFile.hpp"
+#include "read_write_chunk.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <iterator>
+#include <stdexcept>
+
+//cell table entry, as stored in the 'pcl0' chunk:
+struct CellEntry {
+	glm::vec3 min;
+	glm::vec3 max;
+	uint64_t begin; //byte offsets of the cell's data from the start of the file
+	uint64_t end;
+};
+static_assert(sizeof(CellEntry) == 4*3 + 4*3 + 8 + 8, "CellEntry is packed.");
+
+StreamingScene::StreamingScene(Scene &scene_, std::string const &filename_,
+	std::function< void(Scene &, Scene::Transform *, std::string const &) > const &on_drawable_)
+	: scene(scene_), filename(filename_), on_drawable(on_drawable_) {
+
+	auto file = std::make_shared< MappedFile >(filename);
+	if (!file->data()) throw std::runtime_error("partitioned scene file '" + filename + "' is empty.");
+	mapped = file;
+
+	char const *at = file->data();
+	char const *end = file->data() + file->size();
+
+	size_t cells_count;
+	char const *cell_entries = view_chunk< CellEntry >(&at, end, "pcl0", &cells_count);
+
+	cells.reserve(cells_count);
+	for (size_t i = 0; i < cells_count; ++i) {
+		CellEntry e;
+		std::memcpy(&e, cell_entries + i * sizeof(CellEntry), sizeof(CellEntry));
+		if (!(e.begin <= e.end && e.end <= file->size())) {
+			throw std::runtime_error("partitioned scene file '" + filename + "' contains cell " + std::to_string(i) + " with invalid data range.");
+		}
+		cells.emplace_back();
+		Cell &cell = cells.back();
+		cell.min = e.min;
+		cell.max = e.max;
+		cell.begin = file->data() + e.begin;
+		cell.end = file->data() + e.end;
+
+		//estimate resident size from the chunk headers (only touches the first bytes of each chunk):
+		size_t bytes = 0, count = 0;
+		char const *c = cell.begin;
+		view_chunk< char >(&c, cell.end, "str0", &bytes);
+		view_chunk< char >(&c, cell.end, "xfh0", &bytes);
+		count = bytes / 52; //(sizeof HierarchyEntry)
+		cell.bytes += count * (sizeof(Scene::Transform) + 2 * sizeof(void *)); //(list nodes also hold two pointers)
+		view_chunk< char >(&c, cell.end, "msh0", &bytes);
+		count = bytes / 12; //(sizeof MeshEntry)
+		cell.bytes += count * (sizeof(Scene::Drawable) + 2 * sizeof(void *));
+		view_chunk< char >(&c, cell.end, "cam0", &bytes);
+		count = bytes / 20; //(sizeof CameraEntry)
+		cell.bytes += count * (sizeof(Scene::Camera) + 2 * sizeof(void *));
+		view_chunk< char >(&c, cell.end, "lmp0", &bytes);
+		count = bytes / 20; //(sizeof LightEntry)
+		cell.bytes += count * (sizeof(Scene::Light) + 2 * sizeof(void *));
+
+		cell.bytes += size_t(cell.end - cell.begin);
+	}
+}
+
+void StreamingScene::update(glm::vec3 const &focus) {
+	std::vector< float > distance2(cells.size());
+	for (size_t i = 0; i < cells.size(); ++i) {
+		glm::vec3 to_cell = glm::clamp(focus, cells[i].min, cells[i].max) - focus;
+		distance2[i] = glm::dot(to_cell, to_cell);
+	}
+
+	bool changed = false;
+
+	//unload cells that are now out of range:
+	float unload_radius = load_radius + unload_margin;
+	for (size_t i = 0; i < cells.size(); ++i) {
+		if (cells[i].resident && distance2[i] > unload_radius * unload_radius) {
+			unload_cell(cells[i]);
+			changed = true;
+		}
+	}
+
+	//in-range cells that aren't loaded, nearest first:
+	std::vector< uint32_t > wanted;
+	for (size_t i = 0; i < cells.size(); ++i) {
+		if (!cells[i].resident && distance2[i] <= load_radius * load_radius) {
+			wanted.emplace_back(uint32_t(i));
+		}
+	}
+	std::sort(wanted.begin(), wanted.end(), [&](uint32_t a, uint32_t b) {
+		return distance2[a] < distance2[b];
+	});
+
+	stats.deferred = 0;
+	uint32_t loaded = 0;
+	for (uint32_t w : wanted) {
+		Cell &cell = cells[w];
+		if (loaded >= max_loads_per_update) {
+			++stats.deferred;
+			continue;
+		}
+
+		//make room by evicting resident cells farther away than this one, farthest first:
+		while (stats.resident_bytes + cell.bytes > memory_budget) {
+			uint32_t farthest = -1U;
+			for (size_t i = 0; i < cells.size(); ++i) {
+				if (!cells[i].resident || distance2[i] <= distance2[w]) continue;
+				if (farthest == -1U || distance2[i] > distance2[farthest]) farthest = uint32_t(i);
+			}
+			if (farthest == -1U) break;
+			unload_cell(cells[farthest]);
+			changed = true;
+		}
+		if (stats.resident_bytes + cell.bytes > memory_budget) {
+			++stats.deferred;
+			continue;
+		}
+
+		load_cell(cell);
+		changed = true;
+		++loaded;
+	}
+
+	if (changed) scene_changed();
+}
+
+void StreamingScene::unload_all() {
+	bool changed = false;
+	for (auto &cell : cells) {
+		if (cell.resident) {
+			unload_cell(cell);
+			changed = true;
+		}
+	}
+	if (changed) scene_changed();
+}
+
+//position just before anything appended to 'list' from now on:
+template< typename T >
+static typename std::list< T >::iterator append_mark(std::list< T > &list) {
+	return list.empty() ? list.end() : std::prev(list.end());
+}
+
+//first element appended to 'list' since 'mark' was taken (or end()), and how many were appended:
+template< typename T >
+static typename std::list< T >::iterator appended_since(std::list< T > &list, typename std::list< T >::iterator mark, size_t *count) {
+	auto first = (mark == list.end() ? list.begin() : std::next(mark));
+	*count = size_t(std::distance(first, list.end()));
+	return first;
+}
+
+template< typename T >
+static void erase_range(std::list< T > &list, typename std::list< T >::iterator first, size_t count) {
+	list.erase(first, std::next(first, std::ptrdiff_t(count)));
+}
+
+void StreamingScene::load_cell(Cell &cell) {
+	assert(!cell.resident);
+
+	auto transforms_mark = append_mark(scene.transforms);
+	auto drawables_mark = append_mark(scene.drawables);
+	auto cameras_mark = append_mark(scene.cameras);
+	auto lights_mark = append_mark(scene.lights);
+
+	auto record_ranges = [&]() {
+		cell.transforms = appended_since(scene.transforms, transforms_mark, &cell.transforms_count);
+		cell.drawables = appended_since(scene.drawables, drawables_mark, &cell.drawables_count);
+		cell.cameras = appended_since(scene.cameras, cameras_mark, &cell.cameras_count);
+		cell.lights = appended_since(scene.lights, lights_mark, &cell.lights_count);
+	};
+
+	try {
+		scene.load_mapped(mapped, cell.begin, cell.end, filename, on_drawable);
+	} catch (...) {
+		//don't leave a partially-loaded cell behind:
+		record_ranges();
+		unindex_names(cell);
+		erase_range(scene.lights, cell.lights, cell.lights_count);
+		erase_range(scene.cameras, cell.cameras, cell.cameras_count);
+		erase_range(scene.drawables, cell.drawables, cell.drawables_count);
+		erase_range(scene.transforms, cell.transforms, cell.transforms_count);
+		throw;
+	}
+	record_ranges();
+
+	if (anchor) {
+		auto t = cell.transforms;
+		for (size_t i = 0; i < cell.transforms_count; ++i, ++t) {
+			if (t->parent == nullptr) t->parent = anchor;
+		}
+	}
+
+	cell.resident = true;
+	stats.resident_cells += 1;
+	stats.resident_bytes += cell.bytes;
+	stats.peak_resident_bytes = std::max(stats.peak_resident_bytes, stats.resident_bytes);
+	stats.loads += 1;
+}
+
+void StreamingScene::unload_cell(Cell &cell) {
+	assert(cell.resident);
+
+	//(objects before transforms, since they point at the transforms)
+	unindex_names(cell);
+	erase_range(scene.lights, cell.lights, cell.lights_count);
+	erase_range(scene.cameras, cell.cameras, cell.cameras_count);
+	erase_range(scene.drawables, cell.drawables, cell.drawables_count);
+	erase_range(scene.transforms, cell.transforms, cell.transforms_count);
+	cell.transforms_count = cell.drawables_count = cell.cameras_count = cell.lights_count = 0;
+
+	cell.resident = false;
+	stats.resident_cells -= 1;
+	stats.resident_bytes -= cell.bytes;
+	stats.unloads += 1;
+}
+
+void StreamingScene::unindex_names(Cell const &cell) {
+	auto t = cell.transforms;
+	for (size_t i = 0; i < cell.transforms_count; ++i, ++t) {
+		scene.unindex_name(&*t);
+	}
+}
+
+void StreamingScene::scene_changed() {
+	//(the name index is kept current by load_cell and unload_cell)
+	//a freed list node can be reused at the same address by a later load, so don't trust the BVH's change detection:
+	if (scene.bvh) scene.bvh->build(scene);
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+/*
+ * StreamingScene streams the cells of a partitioned scene file into (and out
+ *  of) a Scene as a focus point -- usually the active camera -- moves around.
+ *
+ * A partitioned scene file ('.pscene', written by scenes/partition-scene) is:
+ *  |pcl0|size| CellEntry * N   <-- bounds of each cell + byte range of its data
+ *  ...cell data...             <-- each cell is the usual scene chunks (str0, xfh0, msh0, cam0, lmp0)
+ *
+ * The file is memory-mapped, so only the pages of resident cells are read.
+ *
+ * Cells are appended to the scene's lists, so loading or unloading a cell never
+ *  moves any other transform/drawable/camera/light (pointers to them stay valid).
+ *  Pointers into a cell *do* become invalid when that cell is unloaded.
+ *
+ *  StreamingScene world(scene, data_path("city.pscene"), on_drawable);
+ *  world.load_radius = 80.0f;
+ *  //each frame:
+ *  world.update(camera_position);
+ *
+ */
+
+#include "Scene.hpp"
+
+#include <glm/glm.hpp>
+
+#include <functional>
+#include <list>
+#include <memory>
+#include <string>
+#include <vector>
+
+struct StreamingScene {
+	//read the cell table of 'filename' (cells are loaded into 'scene' by update()); throws on format errors:
+	StreamingScene(Scene &scene, std::string const &filename,
+		std::function< void(Scene &, Scene::Transform *, std::string const &) > const &on_drawable = nullptr
+	);
+
+	//cells within this distance of the focus are loaded:
+	float load_radius = 100.0f;
+	//...and stay loaded until they are farther than load_radius + unload_margin (avoids load/unload thrash at the boundary):
+	float unload_margin = 10.0f;
+	//approximate bytes of resident cell data (mapped file data plus scene objects) to allow:
+	size_t memory_budget = size_t(256) << 20;
+	//cells loaded per update() at most (spreads out the cost of crossing into a dense area):
+	uint32_t max_loads_per_update = 4;
+	//(if non-null) root transforms of loaded cells are parented to this transform:
+	Scene::Transform *anchor = nullptr;
+
+	//load/unload cells around 'focus' (in the anchor's space, or world space if no anchor):
+	void update(glm::vec3 const &focus);
+
+	//unload every resident cell:
+	void unload_all();
+
+	//instrumentation:
+	struct Stats {
+		uint32_t resident_cells = 0;
+		size_t resident_bytes = 0;
+		size_t peak_resident_bytes = 0;
+		uint32_t loads = 0; //cells loaded since construction
+		uint32_t unloads = 0; //cells unloaded since construction
+		uint32_t deferred = 0; //cells in range but not loaded during the last update() (budget or per-update limit)
+	} stats;
+
+	//-- internals ---
+	struct Cell {
+		glm::vec3 min, max;
+		char const *begin, *end; //cell data in the mapped file
+		size_t bytes = 0; //estimated resident size (file bytes + scene objects)
+
+		bool resident = false;
+		//what this cell added to the scene's lists (contiguous, since loads append):
+		std::list< Scene::Transform >::iterator transforms;
+		size_t transforms_count = 0;
+		std::list< Scene::Drawable >::iterator drawables;
+		size_t drawables_count = 0;
+		std::list< Scene::Camera >::iterator cameras;
+		size_t cameras_count = 0;
+		std::list< Scene::Light >::iterator lights;
+		size_t lights_count = 0;
+	};
+	std::vector< Cell > cells;
+
+	Scene &scene;
+	std::string filename;
+	std::function< void(Scene &, Scene::Transform *, std::string const &) > on_drawable;
+	std::shared_ptr< MappedFile const > mapped;
+
+	void load_cell(Cell &cell);
+	void unload_cell(Cell &cell);
+	//remove the cell's transforms from the scene's name index (before they are erased):
+	void unindex_names(Cell const &cell);
+	//the scene's objects changed; make anything cached about them get rebuilt:
+	void scene_changed();
+};
@@ -0,0 +1,214 @@
+#include "TransformArrays.hpp"
+
+#include "Scene.hpp"
+
+#include <unordered_map>
+#include <type_traits>
+#include <stdexcept>
+#include <cassert>
+
+//same math as Scene::Transform::make_local_to_parent():
+static glm::mat4x3 make_local_to_parent(glm::vec3 const &position, glm::quat const &rotation, glm::vec3 const &scale) {
+	glm::mat3 rot = glm::mat3_cast(rotation);
+	return glm::mat4x3(
+		rot[0] * scale.x,
+		rot[1] * scale.y,
+		rot[2] * scale.z,
+		position
+	);
+}
+
+TransformArrays::Handle TransformArrays::add(Handle parent, glm::vec3 const &position, glm::quat const &rotation, glm::vec3 const &scale, std::string const &name) {
+	uint32_t parent_index = (parent == InvalidHandle ? InvalidIndex : index(parent));
+
+	Handle handle;
+	if (!free_handles.empty()) {
+		handle = free_handles.back();
+		free_handles.pop_back();
+	} else {
+		handle = Handle(handle_to_index.size());
+		handle_to_index.emplace_back(InvalidIndex);
+	}
+
+	//appending keeps topological order, since the parent already exists:
+	handle_to_index[handle] = size();
+	positions.emplace_back(position);
+	rotations.emplace_back(rotation);
+	scales.emplace_back(scale);
+	parents.emplace_back(parent_index);
+	names.emplace_back(name);
+	handles.emplace_back(handle);
+	local_to_world.emplace_back(1.0f);
+
+	return handle;
+}
+
+uint32_t TransformArrays::index(Handle handle) const {
+	assert(handle < handle_to_index.size() && "handle out of range");
+	assert(handle_to_index[handle] != InvalidIndex && "handle refers to a removed transform");
+	return handle_to_index[handle];
+}
+
+void TransformArrays::remove(Handle handle) {
+	//the sweep below relies on parents preceding children:
+	if (needs_sort) sort();
+
+	uint32_t first = index(handle);
+
+	//mark the transform and (in one forward pass) all of its descendants:
+	std::vector< bool > removed(size(), false);
+	removed[first] = true;
+	for (uint32_t i = first + 1; i < size(); ++i) {
+		if (parents[i] != InvalidIndex && removed[parents[i]]) removed[i] = true;
+	}
+
+	//compact arrays, remapping parent indices as we go:
+	std::vector< uint32_t > new_index(size(), InvalidIndex);
+	uint32_t out = first;
+	for (uint32_t i = first; i < size(); ++i) {
+		if (removed[i]) {
+			handle_to_index[handles[i]] = InvalidIndex;
+			free_handles.emplace_back(handles[i]);
+			continue;
+		}
+		new_index[i] = out;
+		parents[out] = (parents[i] == InvalidIndex || parents[i] < first ? parents[i] : new_index[parents[i]]);
+		if (out != i) {
+			positions[out] = positions[i];
+			rotations[out] = rotations[i];
+			scales[out] = scales[i];
+			names[out] = std::move(names[i]);
+			handles[out] = handles[i];
+			local_to_world[out] = local_to_world[i];
+		}
+		handle_to_index[handles[out]] = out;
+		++out;
+	}
+	positions.resize(out);
+	rotations.resize(out);
+	scales.resize(out);
+	parents.resize(out);
+	names.resize(out);
+	handles.resize(out);
+	local_to_world.resize(out);
+}
+
+void TransformArrays::set_parent(Handle handle, Handle parent) {
+	uint32_t i = index(handle);
+	if (parent == InvalidHandle) {
+		parents[i] = InvalidIndex;
+		return;
+	}
+	uint32_t p = index(parent);
+
+	//refuse to create cycles:
+	for (uint32_t a = p; a != InvalidIndex; a = parents[a]) {
+		if (a == i) throw std::runtime_error("TransformArrays::set_parent would create a cycle.");
+	}
+
+	parents[i] = p;
+	if (p > i) needs_sort = true;
+}
+
+void TransformArrays::sort() {
+	//build an order where every transform's ancestors are emitted before it,
+	// otherwise keeping the existing order:
+	std::vector< uint32_t > order;
+	order.reserve(size());
+	std::vector< bool > emitted(size(), false);
+	std::vector< uint32_t > chain;
+	for (uint32_t i = 0; i < size(); ++i) {
+		chain.clear();
+		for (uint32_t a = i; a != InvalidIndex && !emitted[a]; a = parents[a]) {
+			chain.emplace_back(a);
+		}
+		for (auto c = chain.rbegin(); c != chain.rend(); ++c) {
+			emitted[*c] = true;
+			order.emplace_back(*c);
+		}
+	}
+	assert(order.size() == size());
+
+	std::vector< uint32_t > new_index(size());
+	for (uint32_t i = 0; i < size(); ++i) {
+		new_index[order[i]] = i;
+	}
+
+	//apply permutation to every array:
+	auto permute = [&order](auto &array) {
+		typename std::remove_reference< decltype(array) >::type temp;
+		temp.reserve(array.size());
+		for (uint32_t o : order) temp.emplace_back(std::move(array[o]));
+		array = std::move(temp);
+	};
+	permute(positions);
+	permute(rotations);
+	permute(scales);
+	permute(parents);
+	permute(names);
+	permute(handles);
+	permute(local_to_world);
+
+	for (uint32_t i = 0; i < size(); ++i) {
+		if (parents[i] != InvalidIndex) parents[i] = new_index[parents[i]];
+		assert(parents[i] == InvalidIndex || parents[i] < i);
+		handle_to_index[handles[i]] = i;
+	}
+
+	needs_sort = false;
+}
+
+void TransformArrays::update_world() {
+	if (needs_sort) sort();
+
+	//parents precede children, so one forward sweep suffices:
+	for (uint32_t i = 0; i < size(); ++i) {
+		glm::mat4x3 local_to_parent = make_local_to_parent(positions[i], rotations[i], scales[i]);
+		if (parents[i] == InvalidIndex) {
+			local_to_world[i] = local_to_parent;
+		} else {
+			local_to_world[i] = local_to_world[parents[i]] * glm::mat4(local_to_parent); //note: glm::mat4(glm::mat4x3) pads with a (0,0,0,1) row
+		}
+	}
+}
+
+void TransformArrays::set(Scene const &scene, std::vector< Handle > *handles_) {
+	clear();
+
+	std::vector< Handle > temp;
+	std::vector< Handle > &scene_handles = (handles_ ? *handles_ : temp);
+	scene_handles.clear();
+	scene_handles.reserve(scene.transforms.size());
+
+	std::unordered_map< Scene::Transform const *, Handle > transform_to_handle;
+	transform_to_handle.reserve(scene.transforms.size());
+
+	//scene transforms may not be in topological order, so add everything first:
+	for (auto const &t : scene.transforms) {
+		Handle h = add(InvalidHandle, t.position, t.rotation, t.scale, std::string(t.name));
+		transform_to_handle.emplace(&t, h);
+		scene_handles.emplace_back(h);
+	}
+
+	//...then hook up parents:
+	uint32_t i = 0;
+	for (auto const &t : scene.transforms) {
+		if (t.parent) set_parent(scene_handles[i], transform_to_handle.at(t.parent));
+		++i;
+	}
+
+	if (needs_sort) sort();
+}
+
+void TransformArrays::clear() {
+	positions.clear();
+	rotations.clear();
+	scales.clear();
+	parents.clear();
+	names.clear();
+	handles.clear();
+	local_to_world.clear();
+	handle_to_index.clear();
+	free_handles.clear();
+	needs_sort = false;
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+/*
+ * TransformArrays is an alternative storage mode for a transform hierarchy,
+ *  built only into scene-bench, where it is measured against Scene's list
+ *  storage (Scene itself doesn't use it).
+ *
+ * Instead of one heap-allocated node per transform (as in Scene::transforms),
+ *  positions, rotations, scales, and parent indices live in separate
+ *  contiguous arrays, kept in topological order (parents before children).
+ * Computing world matrices is then a single linear sweep over the arrays.
+ *
+ * Because sorting and removal move entries around, transforms are referred
+ *  to by 'Handle', which stays valid until that transform is removed.
+ *
+ */
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+struct Scene;
+
+struct TransformArrays {
+	typedef uint32_t Handle;
+	enum : uint32_t { InvalidHandle = -1U, InvalidIndex = -1U };
+
+	//add a transform (optionally as a child of 'parent'):
+	// returns a handle to the new transform
+	Handle add(Handle parent = InvalidHandle,
+		glm::vec3 const &position = glm::vec3(0.0f),
+		glm::quat const &rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f),
+		glm::vec3 const &scale = glm::vec3(1.0f),
+		std::string const &name = ""
+	);
+
+	//remove a transform *and all of its descendants*:
+	void remove(Handle handle);
+
+	//change the parent of a transform:
+	// (may break topological order; sort() is called automatically by update_world() if needed)
+	void set_parent(Handle handle, Handle parent);
+
+	//look up a transform's current (dense) index in the arrays:
+	uint32_t index(Handle handle) const;
+
+	//convenient per-handle accessors:
+	glm::vec3 &position(Handle handle) { return positions[index(handle)]; }
+	glm::quat &rotation(Handle handle) { return rotations[index(handle)]; }
+	glm::vec3 &scale(Handle handle) { return scales[index(handle)]; }
+	glm::mat4x3 const &world(Handle handle) const { return local_to_world[index(handle)]; }
+
+	//restore topological order (parents before children); stable w.r.t. existing order:
+	void sort();
+
+	//compute local_to_world for every transform in one linear pass:
+	void update_world();
+
+	//replace contents with the transforms in a scene:
+	// (if 'handles' is given, it is filled with the handle of each scene transform, in scene.transforms order)
+	void set(Scene const &scene, std::vector< Handle > *handles = nullptr);
+
+	uint32_t size() const { return uint32_t(positions.size()); }
+	void clear();
+
+	//-- storage (indexed by dense index) ---
+
+	std::vector< glm::vec3 > positions;
+	std::vector< glm::quat > rotations;
+	std::vector< glm::vec3 > scales;
+	std::vector< uint32_t > parents; //index of parent, or InvalidIndex for roots
+	std::vector< std::string > names;
+	std::vector< Handle > handles; //index -> handle
+
+	//computed by update_world():
+	std::vector< glm::mat4x3 > local_to_world;
+
+	//-- internals ---
+
+	std::vector< uint32_t > handle_to_index; //handle -> index (InvalidIndex for free handles)
+	std::vector< Handle > free_handles;
+	bool needs_sort = false; //set when set_parent() breaks topological order
+};
@@ -0,0 +1,105 @@
+#include "WorkerPool.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <exception>
+
+thread_local WorkerPool const *WorkerPool::running = nullptr;
+
+WorkerPool::WorkerPool(uint32_t threads) {
+	if (threads == 0) {
+		uint32_t hardware = std::thread::hardware_concurrency();
+		threads = (hardware > 1 ? hardware - 1 : 0);
+	}
+
+	workers.reserve(threads);
+	for (uint32_t t = 0; t < threads; ++t) {
+		workers.emplace_back([this](){
+			uint64_t seen_serial = 0;
+			std::unique_lock< std::mutex > lock(mutex);
+			while (true) {
+				wake.wait(lock, [&](){ return quit || (job && job_serial != seen_serial); });
+				if (quit) return;
+				seen_serial = job_serial;
+				Job &current = *job;
+				++busy;
+				lock.unlock();
+				work_on(current);
+				lock.lock();
+				--busy;
+				finished.notify_all();
+			}
+		});
+	}
+}
+
+WorkerPool::~WorkerPool() {
+	{
+		std::unique_lock< std::mutex > lock(mutex);
+		quit = true;
+	}
+	wake.notify_all();
+	for (auto &worker : workers) {
+		worker.join();
+	}
+}
+
+WorkerPool &WorkerPool::shared() {
+	static WorkerPool pool;
+	return pool;
+}
+
+void WorkerPool::work_on(Job &job) {
+	while (true) {
+		uint32_t begin = job.next.fetch_add(job.grain);
+		if (begin >= job.count) break;
+		uint32_t end = std::min(job.count, begin + job.grain);
+		WorkerPool const *outer = running;
+		running = this;
+		try {
+			(*job.fn)(begin, end);
+		} catch (...) {
+			std::unique_lock< std::mutex > lock(mutex);
+			if (!job.error) job.error = std::current_exception();
+		}
+		running = outer;
+		job.done.fetch_add(end - begin);
+	}
+}
+
+void WorkerPool::parallel_for(uint32_t count, std::function< void(uint32_t, uint32_t) > const &fn, uint32_t grain) {
+	if (count == 0) return;
+	grain = std::max(1U, grain);
+
+	//not worth waking anyone up (or, if called from inside one of this pool's range functions, not possible --
+	// the workers are busy with the outer call, and waiting on them would deadlock):
+	if (workers.empty() || count <= grain || running == this) {
+		fn(0, count);
+		return;
+	}
+
+	std::unique_lock< std::mutex > serial_lock(parallel_for_mutex);
+
+	Job current;
+	current.fn = &fn;
+	current.count = count;
+	current.grain = grain;
+
+	{ //post job:
+		std::unique_lock< std::mutex > lock(mutex);
+		job = &current;
+		++job_serial;
+	}
+	wake.notify_all();
+
+	//help out:
+	work_on(current);
+
+	{ //wait for everything to finish and for all workers to let go of the job:
+		std::unique_lock< std::mutex > lock(mutex);
+		finished.wait(lock, [&](){ return current.done.load() == count && busy == 0; });
+		job = nullptr;
+	}
+
+	if (current.error) std::rethrow_exception(current.error);
+}
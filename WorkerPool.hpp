@@ -0,0 +1,67 @@
+#pragma once
+
+/*
+ * WorkerPool is a small, persistent set of worker threads used to split
+ *  data-parallel loops (e.g., Scene::update_world_matrices) across cores.
+ *
+ * Usage:
+ *  WorkerPool &pool = WorkerPool::shared();
+ *  pool.parallel_for(count, [&](uint32_t begin, uint32_t end) {
+ *      for (uint32_t i = begin; i < end; ++i) { ... }
+ *  });
+ *
+ * parallel_for blocks until all ranges are done; the calling thread helps out.
+ * Calls from different threads take turns. A call from inside a range function
+ *  (a nested parallel_for) runs its whole range inline on that thread.
+ *
+ */
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct WorkerPool {
+	//create a pool with 'threads' workers (0 => one fewer than the number of hardware threads):
+	WorkerPool(uint32_t threads = 0);
+	~WorkerPool();
+
+	//call fn(begin, end) on disjoint ranges covering [0, count), each at most 'grain' long:
+	// (exceptions thrown by fn are re-thrown on the calling thread)
+	void parallel_for(uint32_t count, std::function< void(uint32_t, uint32_t) > const &fn, uint32_t grain = 256);
+
+	//number of worker threads (not counting the calling thread):
+	uint32_t size() const { return uint32_t(workers.size()); }
+
+	//process-wide pool, created on first use:
+	static WorkerPool &shared();
+
+	WorkerPool(WorkerPool const &) = delete;
+	WorkerPool &operator=(WorkerPool const &) = delete;
+
+	//-- internals ---
+	struct Job {
+		std::function< void(uint32_t, uint32_t) > const *fn = nullptr;
+		uint32_t count = 0;
+		uint32_t grain = 1;
+		std::atomic< uint32_t > next{0}; //next unclaimed index
+		std::atomic< uint32_t > done{0}; //number of indices finished
+		std::exception_ptr error;
+	};
+	void work_on(Job &job);
+
+	std::vector< std::thread > workers;
+	std::mutex mutex;
+	std::condition_variable wake; //signalled when a new job is posted (or on shutdown)
+	std::condition_variable finished; //signalled when a job completes
+	Job *job = nullptr;
+	uint64_t job_serial = 0; //incremented per posted job, so workers don't re-enter a finished job
+	uint32_t busy = 0; //workers currently inside work_on()
+	bool quit = false;
+	std::mutex parallel_for_mutex; //only one parallel_for at a time
+	static thread_local WorkerPool const *running; //pool whose range function this thread is inside (for detecting nesting)
+};
@@ -60,3 +60,19 @@ GLuint gl_compile_program(
 
 	return program;
 }
+
+//insert 'defines' after the first line (which must be '#version', since nothing may precede it):
+static std::string with_defines(std::string const &source, std::string const &defines) {
+	if (source.compare(0, 8, "#version") != 0) throw std::runtime_error("Shader source must start with '#version' to add defines.");
+	size_t line_end = source.find('\n');
+	if (line_end == std::string::npos) return source + "\n" + defines;
+	return source.substr(0, line_end + 1) + defines + source.substr(line_end + 1);
+}
+
+GLuint gl_compile_program(
+	std::string const &vertex_shader_source,
+	std::string const &fragment_shader_source,
+	std::string const &defines
+	) {
+	return gl_compile_program(with_defines(vertex_shader_source, defines), with_defines(fragment_shader_source, defines));
+}
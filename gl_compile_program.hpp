@@ -9,3 +9,10 @@
 GLuint gl_compile_program(
 	std::string const &vertex_shader_source,
 	std::string const &fragment_shader_source);
+
+//as above, but with 'defines' (e.g., "#define TEXTURED\n") inserted after the '#version' line of both shaders,
+// so one source can be compiled into several specialized variants:
+GLuint gl_compile_program(
+	std::string const &vertex_shader_source,
+	std::string const &fragment_shader_source,
+	std::string const &defines);
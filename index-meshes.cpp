@@ -0,0 +1,127 @@
+//index-meshes converts a .pnct file to its indexed form, storing each distinct vertex once.
+// usage: index-meshes <in.pnct> <out.pnct>
+//
+//Vertices are identical if all 36 bytes of their data match. Each mesh's range in the 'idx0'
+// chunk becomes a range of the 'elm0' element chunk appended after it (see MeshBuffer::read).
+//Already-indexed input is expanded and re-indexed, so running this twice does no harm.
+
+#include "read_write_chunk.hpp"
+
+#include <glm/glm.hpp>
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+//(these match the chunk layouts read by MeshBuffer::read)
+struct Vertex {
+	glm::vec3 Position;
+	glm::vec3 Normal;
+	glm::u8vec4 Color;
+	glm::vec2 TexCoord;
+};
+static_assert(sizeof(Vertex) == 3*4+3*4+4*1+2*4, "Vertex is packed.");
+
+struct IndexEntry {
+	uint32_t name_begin, name_end;
+	uint32_t vertex_begin, vertex_end;
+};
+static_assert(sizeof(IndexEntry) == 16, "Index entry should be packed");
+
+//vertices compared (and hashed) by their bytes:
+struct VertexBytesHash {
+	size_t operator()(Vertex const &v) const {
+		//FNV-1a:
+		unsigned char bytes[sizeof(Vertex)];
+		std::memcpy(bytes, &v, sizeof(Vertex));
+		uint64_t hash = 0xcbf29ce484222325ULL;
+		for (unsigned char b : bytes) {
+			hash = (hash ^ b) * 0x100000001b3ULL;
+		}
+		return size_t(hash);
+	}
+};
+struct VertexBytesEqual {
+	bool operator()(Vertex const &a, Vertex const &b) const {
+		return std::memcmp(&a, &b, sizeof(Vertex)) == 0;
+	}
+};
+
+int main(int argc, char **argv) {
+	if (argc != 3) {
+		std::cerr << "Usage:\n\t" << argv[0] << " <in.pnct> <out.pnct>" << std::endl;
+		return 1;
+	}
+	std::string in_file = argv[1];
+	std::string out_file = argv[2];
+
+	std::vector< Vertex > vertices;
+	std::vector< char > strings;
+	std::vector< IndexEntry > index;
+	std::vector< uint32_t > elements;
+	bool was_indexed = false;
+	{
+		std::ifstream in(in_file, std::ios::binary);
+		if (!in) {
+			std::cerr << "Failed to open '" << in_file << "'." << std::endl;
+			return 1;
+		}
+		read_chunk(in, "pnct", &vertices);
+		read_chunk(in, "str0", &strings);
+		read_chunk(in, "idx0", &index);
+		if (next_chunk_is(in, "elm0")) {
+			read_chunk(in, "elm0", &elements);
+			was_indexed = true;
+		} else {
+			//not indexed yet -- every vertex is its own element:
+			elements.resize(vertices.size());
+			for (uint32_t i = 0; i < elements.size(); ++i) elements[i] = i;
+		}
+	}
+
+	for (auto const &entry : index) {
+		if (!(entry.vertex_begin <= entry.vertex_end && entry.vertex_end <= elements.size())) {
+			std::cerr << "Index entry in '" << in_file << "' has out-of-range vertex start/count." << std::endl;
+			return 1;
+		}
+	}
+	for (uint32_t e : elements) {
+		if (e >= vertices.size()) {
+			std::cerr << "Element in '" << in_file << "' refers to out-of-range vertex." << std::endl;
+			return 1;
+		}
+	}
+
+	//deduplicate vertices, in order of first use (which keeps each mesh's vertices together):
+	std::vector< Vertex > unique;
+	std::vector< uint32_t > new_elements;
+	new_elements.reserve(elements.size());
+	std::unordered_map< Vertex, uint32_t, VertexBytesHash, VertexBytesEqual > lookup;
+	lookup.reserve(vertices.size());
+	for (uint32_t e : elements) {
+		auto ret = lookup.emplace(vertices[e], uint32_t(unique.size()));
+		if (ret.second) unique.emplace_back(vertices[e]);
+		new_elements.emplace_back(ret.first->second);
+	}
+
+	std::ofstream out(out_file, std::ios::binary);
+	write_chunk("pnct", unique, &out);
+	write_chunk("str0", strings, &out);
+	write_chunk("idx0", index, &out);
+	write_chunk("elm0", new_elements, &out);
+	if (!out) {
+		std::cerr << "Failed to write '" << out_file << "'." << std::endl;
+		return 1;
+	}
+
+	size_t before = vertices.size() * sizeof(Vertex) + (was_indexed ? elements.size() * sizeof(uint32_t) : 0);
+	size_t after = unique.size() * sizeof(Vertex) + new_elements.size() * sizeof(uint32_t);
+	std::cout << "Wrote " << index.size() << " meshes to '" << out_file << "': "
+		<< vertices.size() << " vertices -> " << unique.size() << " unique (" << new_elements.size() << " elements); "
+		<< before << " -> " << after << " bytes of vertex + element data." << std::endl;
+
+	return 0;
+}
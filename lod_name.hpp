@@ -0,0 +1,35 @@
+#pragma once
+
+/*
+ * Coarser levels of detail of a mesh are stored as separate meshes named
+ *  "Name.LOD1", "Name.LOD2", ... (the level is written in decimal without
+ *  leading zeros, so "Name.LOD01" and "Name.LOD0" are ordinary mesh names).
+ *
+ * MeshBuffer and the mesh tools share these helpers so they agree on which
+ *  names are levels.
+ */
+
+#include <string>
+#include <cstdint>
+
+//if 'name' is "Base.LODn", returns n and (if 'base' is non-null) sets *base to "Base";
+// otherwise returns 0 and leaves *base alone:
+inline uint32_t parse_lod_name(std::string const &name, std::string *base = nullptr) {
+	size_t dot = name.rfind(".LOD");
+	if (dot == std::string::npos) return 0;
+	size_t digits = dot + 4;
+	if (digits == name.size() || name[digits] < '1' || name[digits] > '9') return 0;
+	if (name.size() - digits > 9) return 0; //(wouldn't fit in 32 bits)
+	uint32_t level = 0;
+	for (size_t i = digits; i < name.size(); ++i) {
+		if (name[i] < '0' || name[i] > '9') return 0;
+		level = level * 10 + uint32_t(name[i] - '0');
+	}
+	if (base) *base = name.substr(0, dot);
+	return level;
+}
+
+//the name of level 'level' of mesh 'base' (parse_lod_name undoes this):
+inline std::string lod_name(std::string const &base, uint32_t level) {
+	return base + ".LOD" + std::to_string(level);
+}
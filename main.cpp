@@ -6,6 +6,7 @@
 
 //For asset loading:
 #include "Load.hpp"
+#include "AsyncLoader.hpp"
 
 //For sound init:
 #include "Sound.hpp"
@@ -171,6 +172,9 @@ int main(int argc, char **argv) {
 			if (!Mode::current) break;
 		}
 
+		//finish (a bounded amount of) any background loads:
+		AsyncLoader::shared().update();
+
 		{ //(2) call the current mode's "update" function to deal with elapsed time:
 			auto current_time = std::chrono::high_resolution_clock::now();
 			static auto previous_time = current_time;
@@ -198,6 +202,8 @@ int main(int argc, char **argv) {
 	//------------  teardown ------------
 	Sound::shutdown();
 
+	AsyncLoader::shared().cancel();
+
 	SDL_GL_DeleteContext(context);
 	context = 0;
 
@@ -0,0 +1,292 @@
+//optimize-meshes reorders an indexed .pnct file for the GPU's vertex cache and vertex fetch.
+// usage: optimize-meshes <in.pnct> <out.pnct> [cache size = 16]
+//
+//Within each mesh, triangles are reordered with Tipsify (Sander, Nehab, and Barczak, "Fast Triangle
+// Reordering for Vertex Locality and Reduced Overdraw", 2007) so vertices are reused while still in
+// the post-transform cache; the clusters Tipsify produces are then ordered outward-facing first, which
+// tends to draw occluders before what they hide. Finally, vertices are renumbered in order of first use,
+// so vertex fetch walks memory front to back.
+//
+//Mesh ranges (and so names and levels of detail) are unchanged. ACMR -- average cache misses per triangle,
+// on a simulated FIFO cache -- is reported before and after (0.5 is ideal for large grids; 3.0 is no reuse).
+//Input that isn't indexed yet should go through index-meshes first (otherwise there is no reuse to find).
+
+#include "read_write_chunk.hpp"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+//(these match the chunk layouts read by MeshBuffer::read)
+struct Vertex {
+	glm::vec3 Position;
+	glm::vec3 Normal;
+	glm::u8vec4 Color;
+	glm::vec2 TexCoord;
+};
+static_assert(sizeof(Vertex) == 3*4+3*4+4*1+2*4, "Vertex is packed.");
+
+struct IndexEntry {
+	uint32_t name_begin, name_end;
+	uint32_t vertex_begin, vertex_end;
+};
+static_assert(sizeof(IndexEntry) == 16, "Index entry should be packed");
+
+//cache misses when drawing 'count' elements through a FIFO post-transform cache of 'cache_size' entries:
+static uint32_t fifo_misses(uint32_t const *elements, uint32_t count, uint32_t vertex_count, uint32_t cache_size) {
+	std::vector< uint32_t > entered(vertex_count, 0); //miss counter value when each vertex entered the cache (0 = never)
+	uint32_t misses = 0;
+	for (uint32_t i = 0; i < count; ++i) {
+		uint32_t v = elements[i];
+		if (entered[v] != 0 && misses - entered[v] < cache_size) continue; //(still among the last cache_size entries)
+		misses += 1;
+		entered[v] = misses;
+	}
+	return misses;
+}
+
+//Tipsify: reorder the triangles of 'elements' (vertices numbered [0, vertex_count)) for a cache of 'cache_size'.
+// appends the new order to 'out', and the start of each cluster (an index into 'out', relative to its size on entry) to 'clusters'.
+static void tipsify(std::vector< uint32_t > const &elements, uint32_t vertex_count, uint32_t cache_size,
+	std::vector< uint32_t > *out, std::vector< uint32_t > *clusters) {
+	uint32_t triangle_count = uint32_t(elements.size() / 3);
+	uint32_t base = uint32_t(out->size());
+
+	//triangles using each vertex (compressed adjacency):
+	std::vector< uint32_t > live(vertex_count, 0); //triangles not yet emitted, per vertex
+	for (uint32_t e : elements) live[e] += 1;
+	std::vector< uint32_t > adjacency_begin(vertex_count + 1, 0);
+	for (uint32_t v = 0; v < vertex_count; ++v) adjacency_begin[v+1] = adjacency_begin[v] + live[v];
+	std::vector< uint32_t > adjacency(elements.size());
+	{
+		std::vector< uint32_t > fill(adjacency_begin.begin(), adjacency_begin.end() - 1);
+		for (uint32_t i = 0; i < elements.size(); ++i) adjacency[fill[elements[i]]++] = i / 3;
+	}
+
+	std::vector< uint32_t > timestamp(vertex_count, 0);
+	uint32_t time = cache_size + 1;
+	std::vector< bool > emitted(triangle_count, false);
+	std::vector< uint32_t > dead_end; //recently-used vertices, to continue from when a fan runs out
+	uint32_t scan = 0; //next vertex to consider when the dead-end stack is empty
+
+	uint32_t fan = (vertex_count > 0 ? 0 : -1U);
+	bool new_cluster = true;
+	while (fan != -1U) {
+		if (new_cluster) {
+			clusters->emplace_back(uint32_t(out->size()) - base);
+			new_cluster = false;
+		}
+
+		//emit every remaining triangle around 'fan':
+		std::vector< uint32_t > candidates;
+		for (uint32_t a = adjacency_begin[fan]; a < adjacency_begin[fan+1]; ++a) {
+			uint32_t t = adjacency[a];
+			if (emitted[t]) continue;
+			for (uint32_t c = 0; c < 3; ++c) {
+				uint32_t v = elements[3*t+c];
+				out->emplace_back(v);
+				dead_end.emplace_back(v);
+				candidates.emplace_back(v);
+				live[v] -= 1;
+				if (time - timestamp[v] > cache_size) {
+					timestamp[v] = time;
+					time += 1;
+				}
+			}
+			emitted[t] = true;
+		}
+
+		//next fan: the candidate that will still be in the cache after its own triangles are emitted, and has been there longest:
+		uint32_t best = -1U;
+		int32_t best_priority = -1;
+		for (uint32_t v : candidates) {
+			if (live[v] == 0) continue;
+			int32_t priority = 0;
+			if (time - timestamp[v] + 2 * live[v] <= cache_size) priority = int32_t(time - timestamp[v]);
+			if (priority > best_priority) {
+				best_priority = priority;
+				best = v;
+			}
+		}
+		if (best == -1U) {
+			//dead end -- continue from a recently used vertex or, failing that, any vertex with triangles left:
+			// (this is a hard boundary in cache terms, so it starts a new cluster for overdraw ordering)
+			new_cluster = true;
+			while (!dead_end.empty()) {
+				uint32_t v = dead_end.back();
+				dead_end.pop_back();
+				if (live[v] > 0) {
+					best = v;
+					break;
+				}
+			}
+			while (best == -1U && scan < vertex_count) {
+				if (live[scan] > 0) best = scan;
+				++scan;
+			}
+		}
+		fan = best;
+	}
+}
+
+int main(int argc, char **argv) {
+	if (argc != 3 && argc != 4) {
+		std::cerr << "Usage:\n\t" << argv[0] << " <in.pnct> <out.pnct> [cache size = 16]" << std::endl;
+		return 1;
+	}
+	std::string in_file = argv[1];
+	std::string out_file = argv[2];
+	uint32_t cache_size = (argc == 4 ? uint32_t(std::stoul(argv[3])) : 16);
+	if (cache_size < 3) {
+		std::cerr << "Cache size must be at least 3." << std::endl;
+		return 1;
+	}
+
+	std::vector< Vertex > vertices;
+	std::vector< char > strings;
+	std::vector< IndexEntry > index;
+	std::vector< uint32_t > elements;
+	{
+		std::ifstream in(in_file, std::ios::binary);
+		if (!in) {
+			std::cerr << "Failed to open '" << in_file << "'." << std::endl;
+			return 1;
+		}
+		read_chunk(in, "pnct", &vertices);
+		read_chunk(in, "str0", &strings);
+		read_chunk(in, "idx0", &index);
+		if (next_chunk_is(in, "elm0")) {
+			read_chunk(in, "elm0", &elements);
+		} else {
+			std::cerr << "WARNING: '" << in_file << "' is not indexed (run index-meshes on it first); optimizing as-is." << std::endl;
+			elements.resize(vertices.size());
+			for (uint32_t i = 0; i < elements.size(); ++i) elements[i] = i;
+		}
+	}
+	for (auto const &entry : index) {
+		if (!(entry.vertex_begin <= entry.vertex_end && entry.vertex_end <= elements.size())) {
+			std::cerr << "Index entry in '" << in_file << "' has out-of-range vertex start/count." << std::endl;
+			return 1;
+		}
+	}
+	for (uint32_t e : elements) {
+		if (e >= vertices.size()) {
+			std::cerr << "Element in '" << in_file << "' refers to out-of-range vertex." << std::endl;
+			return 1;
+		}
+	}
+
+	uint32_t total_triangles = 0;
+	uint32_t total_before = 0;
+	uint32_t total_after = 0;
+
+	std::vector< uint32_t > local(vertices.size(), -1U); //global vertex -> index within the current mesh
+	for (auto const &entry : index) {
+		std::string name(strings.begin() + entry.name_begin, strings.begin() + entry.name_end);
+		uint32_t count = entry.vertex_end - entry.vertex_begin;
+		uint32_t *range = elements.data() + entry.vertex_begin;
+		if (count % 3 != 0 || count == 0) {
+			std::cerr << "  '" << name << "': not a triangle list; left as-is." << std::endl;
+			continue;
+		}
+
+		//renumber the mesh's vertices compactly:
+		std::vector< uint32_t > global;
+		std::vector< uint32_t > mesh_elements(count);
+		for (uint32_t i = 0; i < count; ++i) {
+			uint32_t v = range[i];
+			if (local[v] == -1U) {
+				local[v] = uint32_t(global.size());
+				global.emplace_back(v);
+			}
+			mesh_elements[i] = local[v];
+		}
+		for (uint32_t v : global) local[v] = -1U;
+		uint32_t vertex_count = uint32_t(global.size());
+
+		uint32_t before = fifo_misses(mesh_elements.data(), count, vertex_count, cache_size);
+
+		std::vector< uint32_t > order;
+		std::vector< uint32_t > clusters;
+		order.reserve(count);
+		tipsify(mesh_elements, vertex_count, cache_size, &order, &clusters);
+		clusters.emplace_back(count);
+
+		//order clusters outward-facing first (by how far they face away from the mesh's center):
+		auto position = [&](uint32_t e) { return vertices[global[e]].Position; };
+		glm::vec3 mesh_center = glm::vec3(0.0f);
+		for (uint32_t e : mesh_elements) mesh_center += position(e);
+		mesh_center /= float(count);
+		std::vector< std::pair< float, uint32_t > > sorted; //(-score, cluster)
+		for (uint32_t c = 0; c + 1 < clusters.size(); ++c) {
+			glm::vec3 center = glm::vec3(0.0f);
+			glm::vec3 normal = glm::vec3(0.0f); //(area-weighted)
+			for (uint32_t i = clusters[c]; i < clusters[c+1]; i += 3) {
+				glm::vec3 a = position(order[i]), b = position(order[i+1]), d = position(order[i+2]);
+				center += a + b + d;
+				normal += glm::cross(b - a, d - a);
+			}
+			center /= float(clusters[c+1] - clusters[c]);
+			sorted.emplace_back(-glm::dot(center - mesh_center, normal), c);
+		}
+		std::stable_sort(sorted.begin(), sorted.end(), [](std::pair< float, uint32_t > const &a, std::pair< float, uint32_t > const &b) {
+			return a.first < b.first;
+		});
+		uint32_t at = 0;
+		for (auto const &s : sorted) {
+			for (uint32_t i = clusters[s.second]; i < clusters[s.second+1]; ++i) {
+				range[at++] = global[order[i]];
+			}
+		}
+
+		//(measured on the final order, so includes any cost of the cluster sort)
+		std::vector< uint32_t > final_elements(count);
+		for (uint32_t i = 0; i < count; ++i) {
+			if (local[range[i]] == -1U) local[range[i]] = i; //(any compact numbering works for counting misses)
+		}
+		for (uint32_t i = 0; i < count; ++i) final_elements[i] = local[range[i]];
+		for (uint32_t i = 0; i < count; ++i) local[range[i]] = -1U;
+		uint32_t after = fifo_misses(final_elements.data(), count, count, cache_size);
+
+		uint32_t triangles = count / 3;
+		std::cout << "  '" << name << "': " << triangles << " triangles, " << vertex_count << " vertices, "
+			<< clusters.size() - 1 << " clusters; ACMR " << float(before) / triangles << " -> " << float(after) / triangles << std::endl;
+		total_triangles += triangles;
+		total_before += before;
+		total_after += after;
+	}
+
+	//renumber vertices in order of first use (vertices no element uses are dropped):
+	std::vector< uint32_t > renumber(vertices.size(), -1U);
+	std::vector< Vertex > new_vertices;
+	new_vertices.reserve(vertices.size());
+	for (uint32_t &e : elements) {
+		if (renumber[e] == -1U) {
+			renumber[e] = uint32_t(new_vertices.size());
+			new_vertices.emplace_back(vertices[e]);
+		}
+		e = renumber[e];
+	}
+
+	std::ofstream out(out_file, std::ios::binary);
+	write_chunk("pnct", new_vertices, &out);
+	write_chunk("str0", strings, &out);
+	write_chunk("idx0", index, &out);
+	write_chunk("elm0", elements, &out);
+	if (!out) {
+		std::cerr << "Failed to write '" << out_file << "'." << std::endl;
+		return 1;
+	}
+
+	if (total_triangles > 0) {
+		std::cout << "Overall ACMR (FIFO cache of " << cache_size << "): " << float(total_before) / total_triangles
+			<< " -> " << float(total_after) / total_triangles << " over " << total_triangles << " triangles." << std::endl;
+	}
+	std::cout << "Wrote " << index.size() << " meshes (" << new_vertices.size() << " vertices) to '" << out_file << "'." << std::endl;
+
+	return 0;
+}
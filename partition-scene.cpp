@@ -0,0 +1,239 @@
+//partition-scene splits a .scene file into a grid of cells for StreamingScene.
+// usage: partition-scene <in.scene> <out.pscene> [cell size = 50] [margin = 0]
+//
+//Each root transform (with its whole subtree) goes in the cell containing the
+// root's position; cells are square in x/y (the scenes are z-up) and unbounded in z.
+//A cell's stored bounds (which StreamingScene loads by) cover its transforms' origins,
+// grown by 'margin' on every side. The scene file doesn't say how far meshes reach
+// past their origins, so pass a margin of at least the largest mesh radius, or
+// big meshes will stream in late.
+//Any chunks after 'lmp0' (read by Scene::load_extra overrides) are not copied.
+
+#include "read_write_chunk.hpp"
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+//(these match the chunk layouts read by Scene::load)
+struct HierarchyEntry {
+	uint32_t parent;
+	uint32_t name_begin;
+	uint32_t name_end;
+	glm::vec3 position;
+	glm::quat rotation;
+	glm::vec3 scale;
+};
+static_assert(sizeof(HierarchyEntry) == 4 + 4 + 4 + 4*3 + 4*4 + 4*3, "HierarchyEntry is packed.");
+
+struct MeshEntry {
+	uint32_t transform;
+	uint32_t name_begin;
+	uint32_t name_end;
+};
+static_assert(sizeof(MeshEntry) == 4 + 4 + 4, "MeshEntry is packed.");
+
+struct CameraEntry {
+	uint32_t transform;
+	char type[4];
+	float data;
+	float clip_near, clip_far;
+};
+static_assert(sizeof(CameraEntry) == 4 + 4 + 4 + 4 + 4, "CameraEntry is packed.");
+
+struct LightEntry {
+	uint32_t transform;
+	char type;
+	glm::u8vec3 color;
+	float energy;
+	float distance;
+	float fov;
+};
+static_assert(sizeof(LightEntry) == 4 + 1 + 3 + 4 + 4 + 4, "LightEntry is packed.");
+
+//(this matches the chunk layout read by StreamingScene)
+struct CellEntry {
+	glm::vec3 min;
+	glm::vec3 max;
+	uint64_t begin;
+	uint64_t end;
+};
+static_assert(sizeof(CellEntry) == 4*3 + 4*3 + 8 + 8, "CellEntry is packed.");
+
+//copy [begin,end) of 'from' to the end of 'to', returning the new range:
+static void copy_name(std::vector< char > const &from, uint32_t *begin, uint32_t *end, std::vector< char > *to) {
+	if (!(*begin <= *end && *end <= from.size())) throw std::runtime_error("entry with invalid name indices");
+	uint32_t new_begin = uint32_t(to->size());
+	to->insert(to->end(), from.begin() + *begin, from.begin() + *end);
+	*begin = new_begin;
+	*end = uint32_t(to->size());
+}
+
+int main(int argc, char **argv) {
+	if (argc < 3 || argc > 5) {
+		std::cerr << "Usage:\n\t" << argv[0] << " <in.scene> <out.pscene> [cell size = 50] [margin = 0]" << std::endl;
+		return 1;
+	}
+	std::string in_file = argv[1];
+	std::string out_file = argv[2];
+	float cell_size = (argc >= 4 ? std::stof(argv[3]) : 50.0f);
+	if (!(cell_size > 0.0f)) {
+		std::cerr << "Cell size must be positive." << std::endl;
+		return 1;
+	}
+	float margin = (argc >= 5 ? std::stof(argv[4]) : 0.0f);
+	if (!(margin >= 0.0f)) {
+		std::cerr << "Margin must not be negative." << std::endl;
+		return 1;
+	}
+
+	std::vector< char > names;
+	std::vector< HierarchyEntry > hierarchy;
+	std::vector< MeshEntry > meshes;
+	std::vector< CameraEntry > cameras;
+	std::vector< LightEntry > lights;
+	{
+		std::ifstream in(in_file, std::ios::binary);
+		if (!in) {
+			std::cerr << "Failed to open '" << in_file << "'." << std::endl;
+			return 1;
+		}
+		read_chunk(in, "str0", &names);
+		read_chunk(in, "xfh0", &hierarchy);
+		read_chunk(in, "msh0", &meshes);
+		read_chunk(in, "cam0", &cameras);
+		read_chunk(in, "lmp0", &lights);
+		if (in.peek() != EOF) {
+			std::cerr << "WARNING: extra chunks in '" << in_file << "' will not be copied." << std::endl;
+		}
+	}
+
+	//world positions and subtree roots of every transform:
+	std::vector< glm::mat4 > world(hierarchy.size());
+	std::vector< uint32_t > root(hierarchy.size());
+	for (uint32_t i = 0; i < hierarchy.size(); ++i) {
+		HierarchyEntry const &h = hierarchy[i];
+		glm::mat3 rs = glm::mat3_cast(h.rotation) * glm::mat3(
+			glm::vec3(h.scale.x, 0.0f, 0.0f),
+			glm::vec3(0.0f, h.scale.y, 0.0f),
+			glm::vec3(0.0f, 0.0f, h.scale.z)
+		);
+		glm::mat4 local = glm::mat4(
+			glm::vec4(rs[0], 0.0f),
+			glm::vec4(rs[1], 0.0f),
+			glm::vec4(rs[2], 0.0f),
+			glm::vec4(h.position, 1.0f)
+		);
+		if (h.parent == -1U) {
+			world[i] = local;
+			root[i] = i;
+		} else {
+			if (h.parent >= i) throw std::runtime_error("transforms are not in topological-sort order");
+			world[i] = world[h.parent] * local;
+			root[i] = root[h.parent];
+		}
+	}
+
+	//assign transforms to grid cells by the position of their root:
+	std::map< std::pair< int32_t, int32_t >, std::vector< uint32_t > > grid;
+	for (uint32_t i = 0; i < hierarchy.size(); ++i) {
+		glm::vec3 at = hierarchy[root[i]].position;
+		auto key = std::make_pair(int32_t(std::floor(at.x / cell_size)), int32_t(std::floor(at.y / cell_size)));
+		grid[key].emplace_back(i);
+	}
+
+	std::vector< CellEntry > cell_entries;
+	std::vector< std::string > cell_data;
+	for (auto const &[key, members] : grid) {
+		//index of each transform within this cell (kept in file order, so still topologically sorted):
+		std::map< uint32_t, uint32_t > local_index;
+		for (uint32_t m : members) {
+			local_index.emplace(m, uint32_t(local_index.size()));
+		}
+
+		std::vector< char > cell_names;
+		std::vector< HierarchyEntry > cell_hierarchy;
+		std::vector< MeshEntry > cell_meshes;
+		std::vector< CameraEntry > cell_cameras;
+		std::vector< LightEntry > cell_lights;
+
+		CellEntry entry = CellEntry();
+		entry.min = glm::vec3(std::numeric_limits< float >::infinity());
+		entry.max = glm::vec3(-std::numeric_limits< float >::infinity());
+
+		for (uint32_t m : members) {
+			HierarchyEntry h = hierarchy[m];
+			if (h.parent != -1U) h.parent = local_index.at(h.parent);
+			copy_name(names, &h.name_begin, &h.name_end, &cell_names);
+			cell_hierarchy.emplace_back(h);
+
+			glm::vec3 at = glm::vec3(world[m][3]);
+			entry.min = glm::min(entry.min, at);
+			entry.max = glm::max(entry.max, at);
+		}
+		entry.min -= glm::vec3(margin);
+		entry.max += glm::vec3(margin);
+		for (MeshEntry m : meshes) {
+			auto f = local_index.find(m.transform);
+			if (f == local_index.end()) continue;
+			m.transform = f->second;
+			copy_name(names, &m.name_begin, &m.name_end, &cell_names);
+			cell_meshes.emplace_back(m);
+		}
+		for (CameraEntry c : cameras) {
+			auto f = local_index.find(c.transform);
+			if (f == local_index.end()) continue;
+			c.transform = f->second;
+			cell_cameras.emplace_back(c);
+		}
+		for (LightEntry l : lights) {
+			auto f = local_index.find(l.transform);
+			if (f == local_index.end()) continue;
+			l.transform = f->second;
+			cell_lights.emplace_back(l);
+		}
+
+		std::ostringstream data;
+		write_chunk("str0", cell_names, &data);
+		write_chunk("xfh0", cell_hierarchy, &data);
+		write_chunk("msh0", cell_meshes, &data);
+		write_chunk("cam0", cell_cameras, &data);
+		write_chunk("lmp0", cell_lights, &data);
+
+		cell_entries.emplace_back(entry);
+		cell_data.emplace_back(data.str());
+
+		std::cout << "Cell (" << key.first << ", " << key.second << "): "
+			<< cell_hierarchy.size() << " transforms, " << cell_meshes.size() << " meshes, "
+			<< cell_data.back().size() << " bytes." << std::endl;
+	}
+
+	//cell data follows the cell table:
+	uint64_t offset = 8 + cell_entries.size() * sizeof(CellEntry);
+	for (size_t i = 0; i < cell_entries.size(); ++i) {
+		cell_entries[i].begin = offset;
+		offset += cell_data[i].size();
+		cell_entries[i].end = offset;
+	}
+
+	std::ofstream out(out_file, std::ios::binary);
+	write_chunk("pcl0", cell_entries, &out);
+	for (auto const &data : cell_data) {
+		out.write(data.data(), data.size());
+	}
+	if (!out) {
+		std::cerr << "Failed to write '" << out_file << "'." << std::endl;
+		return 1;
+	}
+	std::cout << "Wrote " << cell_entries.size() << " cells (" << offset << " bytes) to '" << out_file << "'." << std::endl;
+
+	return 0;
+}
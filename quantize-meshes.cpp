@@ -0,0 +1,291 @@
+//quantize-meshes converts a .pnct file to the compact quantized vertex format (20 bytes per vertex instead of 36).
+// usage: quantize-meshes <in.pnct> <out.pnct>
+//
+//Positions become 16-bit normalized values within a box per mesh (shared by a mesh and its "Name.LODn"
+// levels, so they can be drawn with one pipeline), normals become octahedral-encoded 16-bit pairs, and
+// texture coordinates become half floats; colors are unchanged. See Mesh.hpp for how they are drawn.
+//
+//Indexed input stays indexed (vertices used by meshes with different boxes are duplicated).
+//Run this after index-meshes and optimize-meshes, which only read unquantized files.
+
+#include "read_write_chunk.hpp"
+#include "lod_name.hpp"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+//(these match the chunk layouts read by MeshBuffer::read)
+struct Vertex {
+	glm::vec3 Position;
+	glm::vec3 Normal;
+	glm::u8vec4 Color;
+	glm::vec2 TexCoord;
+};
+static_assert(sizeof(Vertex) == 3*4+3*4+4*1+2*4, "Vertex is packed.");
+
+struct QuantizedVertex {
+	glm::u16vec4 Position;
+	glm::i16vec2 Normal;
+	glm::u8vec4 Color;
+	glm::u16vec2 TexCoord;
+};
+static_assert(sizeof(QuantizedVertex) == 2*4+2*2+4*1+2*2, "QuantizedVertex is packed.");
+
+struct IndexEntry {
+	uint32_t name_begin, name_end;
+	uint32_t vertex_begin, vertex_end;
+};
+static_assert(sizeof(IndexEntry) == 16, "Index entry should be packed");
+
+struct BoxEntry {
+	glm::vec3 offset;
+	glm::vec3 scale;
+};
+static_assert(sizeof(BoxEntry) == 4*3 + 4*3, "Box entry should be packed");
+
+//IEEE half float nearest to 'f' (ties to even):
+static uint16_t to_half(float f) {
+	uint32_t x;
+	std::memcpy(&x, &f, sizeof(x));
+	uint32_t sign = (x >> 16) & 0x8000;
+	uint32_t float_exponent = (x >> 23) & 0xff;
+	uint32_t mantissa = x & 0x7fffff;
+	if (float_exponent == 0xff) return uint16_t(sign | 0x7c00 | (mantissa ? 0x200 : 0)); //infinity or NaN
+	int32_t exponent = int32_t(float_exponent) - 127 + 15;
+	if (exponent >= 31) return uint16_t(sign | 0x7c00); //too large: infinity
+	if (exponent <= 0) {
+		//subnormal (or zero):
+		if (exponent < -10) return uint16_t(sign);
+		mantissa |= 0x800000;
+		uint32_t shift = uint32_t(14 - exponent);
+		uint32_t half = mantissa >> shift;
+		uint32_t rest = mantissa & ((1U << shift) - 1U);
+		uint32_t halfway = 1U << (shift - 1U);
+		if (rest > halfway || (rest == halfway && (half & 1U))) half += 1;
+		return uint16_t(sign | half);
+	}
+	uint32_t half = sign | (uint32_t(exponent) << 10) | (mantissa >> 13);
+	uint32_t rest = mantissa & 0x1fff;
+	if (rest > 0x1000 || (rest == 0x1000 && (half & 1U))) half += 1; //(a carry into the exponent is still correctly rounded)
+	return uint16_t(half);
+}
+
+//octahedral encoding of a unit vector (both components in [-1,1]):
+static glm::vec2 octahedral(glm::vec3 n) {
+	float sum = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+	if (sum == 0.0f) return glm::vec2(0.0f);
+	n /= sum;
+	glm::vec2 e = glm::vec2(n.x, n.y);
+	if (n.z < 0.0f) {
+		e = glm::vec2(
+			(1.0f - std::abs(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f),
+			(1.0f - std::abs(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f)
+		);
+	}
+	return e;
+}
+
+//(same as MeshBuffer::OctahedralNormalGLSL, for reporting error)
+static glm::vec3 octahedral_normal(glm::vec2 e) {
+	glm::vec3 n = glm::vec3(e.x, e.y, 1.0f - std::abs(e.x) - std::abs(e.y));
+	if (n.z < 0.0f) {
+		n = glm::vec3(
+			(1.0f - std::abs(e.y)) * (e.x >= 0.0f ? 1.0f : -1.0f),
+			(1.0f - std::abs(e.x)) * (e.y >= 0.0f ? 1.0f : -1.0f),
+			n.z
+		);
+	}
+	return glm::normalize(n);
+}
+
+static int16_t to_snorm16(float v) {
+	return int16_t(std::round(std::max(-1.0f, std::min(1.0f, v)) * 32767.0f));
+}
+
+//base mesh of a level of detail ("Name.LOD2" -> "Name"; anything else is its own base):
+static std::string lod_base(std::string const &name) {
+	std::string base;
+	if (parse_lod_name(name, &base)) return base;
+	return name;
+}
+
+int main(int argc, char **argv) {
+	if (argc != 3) {
+		std::cerr << "Usage:\n\t" << argv[0] << " <in.pnct> <out.pnct>" << std::endl;
+		return 1;
+	}
+	std::string in_file = argv[1];
+	std::string out_file = argv[2];
+
+	std::vector< Vertex > vertices;
+	std::vector< char > strings;
+	std::vector< IndexEntry > index;
+	std::vector< uint32_t > elements;
+	bool indexed = false;
+	{
+		std::ifstream in(in_file, std::ios::binary);
+		if (!in) {
+			std::cerr << "Failed to open '" << in_file << "'." << std::endl;
+			return 1;
+		}
+		read_chunk(in, "pnct", &vertices);
+		read_chunk(in, "str0", &strings);
+		read_chunk(in, "idx0", &index);
+		if (next_chunk_is(in, "elm0")) {
+			read_chunk(in, "elm0", &elements);
+			indexed = true;
+		} else {
+			elements.resize(vertices.size());
+			for (uint32_t i = 0; i < elements.size(); ++i) elements[i] = i;
+		}
+	}
+	for (auto const &entry : index) {
+		if (!(entry.name_begin <= entry.name_end && entry.name_end <= strings.size())) {
+			std::cerr << "Index entry in '" << in_file << "' has out-of-range name begin/end." << std::endl;
+			return 1;
+		}
+		if (!(entry.vertex_begin <= entry.vertex_end && entry.vertex_end <= elements.size())) {
+			std::cerr << "Index entry in '" << in_file << "' has out-of-range vertex start/count." << std::endl;
+			return 1;
+		}
+	}
+	for (uint32_t e : elements) {
+		if (e >= vertices.size()) {
+			std::cerr << "Element in '" << in_file << "' refers to out-of-range vertex." << std::endl;
+			return 1;
+		}
+	}
+
+	//boxes, one per group of a mesh and its levels of detail:
+	std::vector< uint32_t > group(index.size());
+	std::map< std::string, uint32_t > group_of_base;
+	std::vector< glm::vec3 > group_min, group_max;
+	for (uint32_t m = 0; m < index.size(); ++m) {
+		std::string name(strings.begin() + index[m].name_begin, strings.begin() + index[m].name_end);
+		auto ret = group_of_base.emplace(lod_base(name), uint32_t(group_min.size()));
+		if (ret.second) {
+			group_min.emplace_back( std::numeric_limits< float >::infinity());
+			group_max.emplace_back(-std::numeric_limits< float >::infinity());
+		}
+		uint32_t g = group[m] = ret.first->second;
+		for (uint32_t i = index[m].vertex_begin; i < index[m].vertex_end; ++i) {
+			group_min[g] = glm::min(group_min[g], vertices[elements[i]].Position);
+			group_max[g] = glm::max(group_max[g], vertices[elements[i]].Position);
+		}
+	}
+	std::vector< BoxEntry > group_box(group_min.size());
+	for (uint32_t g = 0; g < group_box.size(); ++g) {
+		if (!(group_min[g].x <= group_max[g].x)) { //(empty group)
+			group_box[g].offset = glm::vec3(0.0f);
+			group_box[g].scale = glm::vec3(1.0f);
+			continue;
+		}
+		group_box[g].offset = group_min[g];
+		glm::vec3 size = group_max[g] - group_min[g];
+		//(flat boxes keep scale 1, so positions decode to exactly the offset)
+		group_box[g].scale = glm::vec3(size.x > 0.0f ? size.x : 1.0f, size.y > 0.0f ? size.y : 1.0f, size.z > 0.0f ? size.z : 1.0f);
+	}
+
+	//the box each output vertex is quantized in -- vertices shared between groups get a copy per group:
+	std::vector< uint32_t > source; //input vertex of each output vertex
+	std::vector< uint32_t > source_group; //group of each output vertex
+	std::vector< uint32_t > new_elements = elements;
+	if (indexed) {
+		std::map< std::pair< uint32_t, uint32_t >, uint32_t > made; //(group, input vertex) -> output vertex
+		std::vector< bool > done(elements.size(), false);
+		for (uint32_t m = 0; m < index.size(); ++m) {
+			for (uint32_t i = index[m].vertex_begin; i < index[m].vertex_end; ++i) {
+				auto ret = made.emplace(std::make_pair(group[m], elements[i]), uint32_t(source.size()));
+				if (ret.second) {
+					source.emplace_back(elements[i]);
+					source_group.emplace_back(group[m]);
+				}
+				if (done[i] && new_elements[i] != ret.first->second) {
+					std::cerr << "Meshes in '" << in_file << "' with different boxes overlap in the element chunk." << std::endl;
+					return 1;
+				}
+				new_elements[i] = ret.first->second;
+				done[i] = true;
+			}
+		}
+		//(elements no mesh uses keep pointing at something valid)
+		for (uint32_t i = 0; i < elements.size(); ++i) {
+			if (!done[i]) new_elements[i] = 0;
+		}
+	} else {
+		//vertex ranges are quantized in place, so they can't be shared between groups:
+		source.resize(vertices.size());
+		source_group.assign(vertices.size(), 0);
+		std::vector< bool > done(vertices.size(), false);
+		for (uint32_t v = 0; v < vertices.size(); ++v) source[v] = v;
+		for (uint32_t m = 0; m < index.size(); ++m) {
+			for (uint32_t v = index[m].vertex_begin; v < index[m].vertex_end; ++v) {
+				if (done[v] && source_group[v] != group[m]) {
+					std::cerr << "Meshes in '" << in_file << "' with different boxes share vertices; run index-meshes on it first." << std::endl;
+					return 1;
+				}
+				source_group[v] = group[m];
+				done[v] = true;
+			}
+		}
+	}
+
+	//quantize:
+	std::vector< QuantizedVertex > quantized(source.size());
+	float max_position_error = 0.0f;
+	float max_normal_error = 0.0f; //(degrees)
+	for (uint32_t q = 0; q < source.size(); ++q) {
+		Vertex const &v = vertices[source[q]];
+		BoxEntry const &box = group_box[source_group[q]];
+		QuantizedVertex &out = quantized[q];
+
+		glm::vec3 t = glm::clamp((v.Position - box.offset) / box.scale, glm::vec3(0.0f), glm::vec3(1.0f));
+		out.Position = glm::u16vec4(
+			uint16_t(std::round(t.x * 65535.0f)),
+			uint16_t(std::round(t.y * 65535.0f)),
+			uint16_t(std::round(t.z * 65535.0f)),
+			0
+		);
+		glm::vec3 decoded = box.offset + box.scale * (glm::vec3(out.Position.x, out.Position.y, out.Position.z) / 65535.0f);
+		max_position_error = std::max(max_position_error, glm::length(decoded - v.Position));
+
+		glm::vec2 e = octahedral(v.Normal);
+		out.Normal = glm::i16vec2(to_snorm16(e.x), to_snorm16(e.y));
+		if (glm::dot(v.Normal, v.Normal) > 0.0f) {
+			glm::vec3 n = octahedral_normal(glm::vec2(out.Normal.x, out.Normal.y) / 32767.0f);
+			float c = std::max(-1.0f, std::min(1.0f, glm::dot(n, glm::normalize(v.Normal))));
+			max_normal_error = std::max(max_normal_error, std::acos(c) * (180.0f / 3.14159265f));
+		}
+
+		out.Color = v.Color;
+		out.TexCoord = glm::u16vec2(to_half(v.TexCoord.x), to_half(v.TexCoord.y));
+	}
+
+	std::ofstream out(out_file, std::ios::binary);
+	write_chunk("pnq0", quantized, &out);
+	write_chunk("str0", strings, &out);
+	write_chunk("idx0", index, &out);
+	std::vector< BoxEntry > boxes(index.size());
+	for (uint32_t m = 0; m < index.size(); ++m) boxes[m] = group_box[group[m]];
+	write_chunk("qbx0", boxes, &out);
+	if (indexed) write_chunk("elm0", new_elements, &out);
+	if (!out) {
+		std::cerr << "Failed to write '" << out_file << "'." << std::endl;
+		return 1;
+	}
+
+	std::cout << "Wrote " << index.size() << " meshes (" << group_box.size() << " boxes) to '" << out_file << "': "
+		<< vertices.size() << " vertices (" << vertices.size() * sizeof(Vertex) << " bytes) -> "
+		<< quantized.size() << " vertices (" << quantized.size() * sizeof(QuantizedVertex) << " bytes)." << std::endl;
+	std::cout << "  largest position error " << max_position_error << ", largest normal error " << max_normal_error << " degrees." << std::endl;
+
+	return 0;
+}
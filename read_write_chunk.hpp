@@ -4,6 +4,7 @@
 #include <vector>
 #include <stdexcept>
 #include <cassert>
+#include <cstring>
 
 //helper function that reads an array of structures preceded by a simple header:
 //Expected format:
@@ -40,6 +41,56 @@ void read_chunk(std::istream &from, std::string const &magic, std::vector< T > *
 	}
 }
 
+//helper function that checks whether the next chunk in a stream has the given magic number,
+// without consuming anything (false at end of stream or if fewer than four bytes remain):
+inline bool next_chunk_is(std::istream &from, std::string const &magic) {
+	assert(magic.size() == 4);
+	std::streampos at = from.tellg();
+	char next[4];
+	bool match = (from.read(next, 4) && std::string(next, 4) == magic);
+	from.clear();
+	from.seekg(at);
+	return match;
+}
+
+//helper function that locates a chunk (same format as above) in memory, without copying:
+// checks the header at *at, advances *at past the chunk, and returns a pointer to the chunk's data,
+// setting *count to the number of T structures it holds.
+// (the data is not necessarily aligned for T -- copy elements out with std::memcpy)
+template< typename T >
+char const *view_chunk(char const **at_, char const *end, std::string const &magic, size_t *count) {
+	assert(at_ && *at_ && end);
+	assert(count);
+	char const *&at = *at_;
+
+	struct ChunkHeader {
+		char magic[4] = {'\0', '\0', '\0', '\0'};
+		uint32_t size = 0;
+	};
+	static_assert(sizeof(ChunkHeader) == 8, "header is packed");
+
+	ChunkHeader header;
+	if (size_t(end - at) < sizeof(header)) {
+		throw std::runtime_error("Failed to read chunk header");
+	}
+	std::memcpy(&header, at, sizeof(header));
+	if (std::string(header.magic,4) != magic) {
+		throw std::runtime_error("Unexpected magic number in chunk");
+	}
+
+	if (header.size % sizeof(T) != 0) {
+		throw std::runtime_error("Size of chunk not divisible by element size");
+	}
+
+	if (size_t(end - at) - sizeof(header) < header.size) {
+		throw std::runtime_error("Failed to read chunk data.");
+	}
+
+	char const *data = at + sizeof(header);
+	at = data + header.size;
+	*count = header.size / sizeof(T);
+	return data;
+}
 
 //helper function to write a chunk of data in the same format as read_chunk:
 template< typename T >
@@ -0,0 +1,311 @@
+//Micro-benchmarks for scene data structures.
+// run from the command line; prints timings to stdout.
+
+#include "Scene.hpp"
+#include "LightClusters.hpp"
+#include "OcclusionBuffer.hpp"
+#include "TransformArrays.hpp"
+#include "WorkerPool.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <functional>
+#include <unordered_map>
+
+//build a random forest of 'count' transforms, roughly 10% roots:
+static void make_forest(Scene &scene, uint32_t count, uint32_t seed) {
+	std::mt19937 mt(seed);
+	std::vector< Scene::Transform * > made;
+	made.reserve(count);
+	for (uint32_t i = 0; i < count; ++i) {
+		scene.transforms.emplace_back();
+		Scene::Transform *t = &scene.transforms.back();
+		scene.set_name(t, "T" + std::to_string(i));
+		t->position = glm::vec3(
+			(mt() % 1000) / 100.0f,
+			(mt() % 1000) / 100.0f,
+			(mt() % 1000) / 100.0f
+		);
+		t->rotation = glm::angleAxis((mt() % 628) / 100.0f, glm::vec3(0.0f, 0.0f, 1.0f));
+		if (!made.empty() && mt() % 10 != 0) {
+			t->parent = made[mt() % made.size()];
+		}
+		made.emplace_back(t);
+	}
+}
+
+//run 'fn' repeatedly for roughly 'budget' seconds; return average milliseconds per call:
+static double time_ms(std::function< void() > const &fn, double budget = 0.25) {
+	using clock = std::chrono::high_resolution_clock;
+	fn(); //warm up
+	uint32_t iterations = 0;
+	auto before = clock::now();
+	double elapsed = 0.0;
+	do {
+		fn();
+		++iterations;
+		elapsed = std::chrono::duration< double >(clock::now() - before).count();
+	} while (elapsed < budget);
+	return elapsed / iterations * 1000.0;
+}
+
+static void report(std::string const &what, uint32_t count, double ms) {
+	std::cout << "  " << std::left << std::setw(44) << what
+	          << std::right << std::setw(8) << count
+	          << std::setw(12) << std::fixed << std::setprecision(3) << ms << " ms" << std::endl;
+}
+
+static void bench_traversal(uint32_t count) {
+	Scene scene;
+	make_forest(scene, count, 0xfeed + count);
+
+	std::vector< Scene::Transform * > roots;
+	for (auto &t : scene.transforms) {
+		if (!t.parent) roots.emplace_back(&t);
+	}
+
+	float wiggle = 0.0f;
+	glm::vec3 sink = glm::vec3(0.0f);
+
+	//std::list storage, all transforms dirty (roots moved every sweep):
+	report("list: move roots + world matrices", count, time_ms([&](){
+		wiggle += 0.001f;
+		for (auto r : roots) r->position.x += wiggle;
+		for (auto const &t : scene.transforms) sink += t.make_local_to_world()[3];
+	}));
+
+	//std::list storage, nothing changed (cached matrices):
+	report("list: world matrices (cached)", count, time_ms([&](){
+		for (auto const &t : scene.transforms) sink += t.make_local_to_world()[3];
+	}));
+
+	//std::list storage, roots moved every sweep, level-parallel update:
+	report("list: move roots + update_world_matrices", count, time_ms([&](){
+		wiggle += 0.001f;
+		for (auto r : roots) r->position.x += wiggle;
+		scene.update_world_matrices();
+		//(read back the way draw() does after update_world_matrices -- without re-checking each parent chain)
+		for (auto const &t : scene.transforms) sink += t.world_cache.local_to_world[3];
+	}));
+
+	//SoA storage, roots moved every sweep:
+	TransformArrays arrays;
+	arrays.set(scene);
+	std::vector< uint32_t > root_indices;
+	for (uint32_t i = 0; i < arrays.size(); ++i) {
+		if (arrays.parents[i] == TransformArrays::InvalidIndex) root_indices.emplace_back(i);
+	}
+	report("soa:  move roots + update_world()", count, time_ms([&](){
+		wiggle += 0.001f;
+		for (auto r : root_indices) arrays.positions[r].x += wiggle;
+		arrays.update_world();
+		sink += arrays.local_to_world.back()[3];
+	}));
+
+	if (sink.x == 1234.5f) std::cout << "(unlikely)" << std::endl; //keep 'sink' alive
+}
+
+//the previous Scene::set, which remapped pointers through a hash map (kept here for comparison):
+static void set_with_hash_map(Scene &scene, Scene const &other) {
+	std::unordered_map< Scene::Transform const *, Scene::Transform * > transform_to_transform;
+	transform_to_transform.insert(std::make_pair(nullptr, nullptr));
+
+	scene.transforms.clear();
+	for (auto const &t : other.transforms) {
+		scene.transforms.emplace_back();
+		scene.transforms.back().name = t.name;
+		scene.transforms.back().position = t.position;
+		scene.transforms.back().rotation = t.rotation;
+		scene.transforms.back().scale = t.scale;
+		scene.transforms.back().parent = t.parent;
+		transform_to_transform.insert(std::make_pair(&t, &scene.transforms.back()));
+	}
+	for (auto &t : scene.transforms) {
+		t.parent = transform_to_transform.at(t.parent);
+	}
+
+	scene.drawables = other.drawables;
+	for (auto &d : scene.drawables) {
+		d.transform = transform_to_transform.at(d.transform);
+	}
+
+	scene.name_storage = other.name_storage;
+}
+
+static void bench_copy(uint32_t count) {
+	Scene scene;
+	make_forest(scene, count, 0xc0b1 + count);
+	for (auto &t : scene.transforms) {
+		scene.drawables.emplace_back(&t);
+	}
+	scene.update_world_matrices();
+
+	Scene copy;
+	report("hash map remap (previous Scene::set)", count, time_ms([&](){
+		set_with_hash_map(copy, scene);
+	}));
+	report("Scene::set", count, time_ms([&](){
+		copy.set(scene);
+	}));
+	//the copy above also carries over cached world matrices, so include the cost of rebuilding them:
+	report("hash map remap + update_world_matrices", count, time_ms([&](){
+		set_with_hash_map(copy, scene);
+		copy.update_world_matrices();
+	}));
+	report("Scene::set + update_world_matrices", count, time_ms([&](){
+		copy.set(scene);
+		copy.update_world_matrices();
+	}));
+}
+
+//city-like grid of box buildings seen from street level, with 'count' small objects scattered among them:
+static void bench_occlusion(uint32_t count) {
+	std::mt19937 mt(0xc17e + count);
+	Scene scene;
+
+	OcclusionBuffer occlusion;
+	for (int32_t bx = 0; bx < 20; ++bx) {
+		for (int32_t by = -10; by < 10; ++by) {
+			scene.transforms.emplace_back();
+			Scene::Transform *t = &scene.transforms.back();
+			t->position = glm::vec3(bx * 20.0f + 10.0f, by * 20.0f + 10.0f, 0.0f);
+			float height = 10.0f + (mt() % 30);
+			occlusion.add_box_occluder(t, glm::vec3(-7.0f, -7.0f, 0.0f), glm::vec3(7.0f, 7.0f, height));
+		}
+	}
+
+	std::vector< std::pair< glm::vec3, glm::vec3 > > boxes;
+	boxes.reserve(count);
+	for (uint32_t i = 0; i < count; ++i) {
+		glm::vec3 at = glm::vec3((mt() % 40000) / 100.0f, (mt() % 40000) / 100.0f - 200.0f, (mt() % 300) / 100.0f);
+		boxes.emplace_back(at - glm::vec3(0.5f), at + glm::vec3(0.5f));
+	}
+
+	//camera in the street at y = 0, looking down +x (z up):
+	glm::vec3 eye = glm::vec3(-5.0f, 0.0f, 1.7f);
+	glm::mat4 world_to_view = glm::mat4(
+		glm::vec4(0.0f, 0.0f,-1.0f, 0.0f),
+		glm::vec4(-1.0f, 0.0f, 0.0f, 0.0f),
+		glm::vec4(0.0f, 1.0f, 0.0f, 0.0f),
+		glm::vec4(0.0f, 0.0f, 0.0f, 1.0f)
+	);
+	world_to_view[3] = glm::vec4(-glm::vec3(world_to_view * glm::vec4(eye, 0.0f)), 1.0f);
+	glm::mat4 world_to_clip = glm::infinitePerspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f) * world_to_view;
+
+	auto run = [&](bool simd, std::vector< bool > *visible) {
+		occlusion.simd = simd;
+		occlusion.clear();
+		for (auto const &o : occlusion.occluders) {
+			occlusion.rasterize(world_to_clip * glm::mat4(o.transform->make_local_to_world()), o.triangles->data(), o.triangles->size() / 3);
+		}
+		if (visible) visible->clear();
+		for (auto const &b : boxes) {
+			bool v = occlusion.box_visible(world_to_clip, b.first, b.second);
+			if (visible) visible->emplace_back(v);
+		}
+	};
+
+	std::vector< bool > simd_visible, scalar_visible;
+	run(true, &simd_visible);
+	uint32_t occluded = occlusion.stats.boxes_occluded;
+	std::vector< float > simd_depth = occlusion.depth;
+	run(false, &scalar_visible);
+	bool agree = (simd_visible == scalar_visible && simd_depth == occlusion.depth);
+
+	report("occlusion (SSE2 where available)", count, time_ms([&](){ run(true, nullptr); }));
+	report("occlusion (scalar)", count, time_ms([&](){ run(false, nullptr); }));
+	std::cout << "    " << occluded << " of " << count << " objects occluded by " << occlusion.occluders.size() << " buildings; "
+	          << (agree ? "SIMD and scalar results agree" : "MISMATCH between SIMD and scalar results") << std::endl;
+}
+
+//'count' point and spot lights scattered through a town-sized volume, assigned to clusters of a camera in its middle:
+static void bench_lights(uint32_t count) {
+	std::mt19937 mt(0x11647 + count);
+	std::vector< LightClusters::Light > lights;
+	lights.reserve(count);
+	for (uint32_t i = 0; i < count; ++i) {
+		LightClusters::Light light;
+		light.position = glm::vec3((mt() % 40000) / 100.0f - 200.0f, (mt() % 40000) / 100.0f - 200.0f, (mt() % 2000) / 100.0f);
+		light.radius = 2.0f + (mt() % 1000) / 100.0f;
+		if (mt() % 3 == 0) {
+			light.direction = glm::normalize(glm::vec3((mt() % 200) / 100.0f - 1.0f, (mt() % 200) / 100.0f - 1.0f, -1.0f));
+			light.cos_half_angle = std::cos(glm::radians(10.0f + (mt() % 50)));
+		}
+		lights.emplace_back(light);
+	}
+
+	//camera at the center of the volume, looking down +x (z up):
+	glm::vec3 eye = glm::vec3(0.0f, 0.0f, 1.7f);
+	glm::mat4 world_to_view = glm::mat4(
+		glm::vec4(0.0f, 0.0f,-1.0f, 0.0f),
+		glm::vec4(-1.0f, 0.0f, 0.0f, 0.0f),
+		glm::vec4(0.0f, 1.0f, 0.0f, 0.0f),
+		glm::vec4(0.0f, 0.0f, 0.0f, 1.0f)
+	);
+	world_to_view[3] = glm::vec4(-glm::vec3(world_to_view * glm::vec4(eye, 0.0f)), 1.0f);
+	glm::mat4x3 view = glm::mat4x3(world_to_view);
+	float fovy = glm::radians(60.0f);
+	float aspect = 16.0f / 9.0f;
+
+	LightClusters clusters;
+	auto results = [&]() {
+		std::vector< uint32_t > flat;
+		for (auto const &c : clusters.clusters) {
+			flat.emplace_back(c.count);
+			flat.insert(flat.end(), clusters.indices.begin() + c.offset, clusters.indices.begin() + c.offset + c.count);
+		}
+		return flat;
+	};
+
+	clusters.assign_brute_force(view, fovy, aspect, lights);
+	std::vector< uint32_t > expected = results();
+	clusters.simd = false;
+	clusters.assign(view, fovy, aspect, lights);
+	bool agree = (results() == expected);
+	clusters.simd = true;
+	clusters.assign(view, fovy, aspect, lights);
+	agree = agree && (results() == expected);
+	LightClusters::Stats stats = clusters.stats;
+
+	report("clustered assignment (SSE2 where available)", count, time_ms([&](){ clusters.assign(view, fovy, aspect, lights); }));
+	clusters.simd = false;
+	report("clustered assignment (scalar)", count, time_ms([&](){ clusters.assign(view, fovy, aspect, lights); }));
+	if (count <= 10000) {
+		report("clustered assignment (brute force)", count, time_ms([&](){ clusters.assign_brute_force(view, fovy, aspect, lights); }));
+	}
+	std::cout << "    " << stats.lights_in_range << " lights in range, " << stats.clusters_tested << " clusters tested, "
+	          << stats.assignments << " assignments; "
+	          << (agree ? "results match brute force" : "MISMATCH with brute force results") << std::endl;
+}
+
+int main() {
+	std::vector< uint32_t > sizes{1000, 10000, 100000};
+
+	std::cout << "Transform traversal (list vs. SoA; " << WorkerPool::shared().size() << " worker threads):" << std::endl;
+	for (uint32_t count : sizes) {
+		bench_traversal(count);
+	}
+
+	std::cout << "Scene copy (transforms + one drawable each):" << std::endl;
+	for (uint32_t count : sizes) {
+		bench_copy(count);
+	}
+
+	std::cout << "Occlusion culling (" << OcclusionBuffer().width << "x" << OcclusionBuffer().height << " depth buffer):" << std::endl;
+	for (uint32_t count : sizes) {
+		bench_occlusion(count);
+	}
+
+	{
+		LightClusters clusters;
+		std::cout << "Light clusters (" << clusters.tiles_x << "x" << clusters.tiles_y << "x" << clusters.slices << "):" << std::endl;
+	}
+	for (uint32_t count : sizes) {
+		bench_lights(count);
+	}
+
+	return 0;
+}